@@ -0,0 +1,325 @@
+#include "Analytics.h"
+#include "Threads.h"
+#include <stdio.h>
+#include <string.h>
+
+// multiple producer ring: a game claims a slot by advancing head, fills it and
+// marks it filled, the writer takes filled slots in order and advances tail
+static AnalyticsEvent ring[ANALYTICS_QUEUE];
+static volatile long filled[ANALYTICS_QUEUE]; // position + 1 once the slot's record is written
+static volatile long head, tail; // head counts every record accepted since analytics_start
+static volatile long dropped; // counted by the games
+
+// writer state, only one log runs at a time
+static AnalyticsEvent batch[ANALYTICS_BATCH];
+static int batchCount;
+static Thread writer;
+static volatile bool running = false, stopping;
+static FILE *out;
+static char outPrefix[260];
+static long rotateAt, fileBytes;
+static AnalyticsStats stats;
+
+// byte size of each column, in AnalyticsEvent order
+static const int columnSize[ANALYTICS_COLUMNS] = { 4, 4, 4, 2, 1, 1, 1, 1, 1, 1, 1 };
+
+static bool open_file(void)
+{
+	char path[280];
+
+	sprintf(path, "%s%03d.tpa", outPrefix, stats.files);
+	out = fopen(path, "wb");
+	if(!out)
+		return false;
+	fwrite("TPA1", 1, 4, out);
+	fileBytes = 4;
+	stats.files++;
+	return true;
+}
+
+// copies one field out of every record so each column is contiguous
+static void write_column(int column, int n)
+{
+	static unsigned char values[ANALYTICS_BATCH * 4];
+	unsigned char *p = values;
+
+	for(int i = 0; i < n; i++)
+	{
+		const AnalyticsEvent *e = &batch[i];
+
+		switch(column)
+		{
+		case 0: memcpy(p, &e->tick, 4); break;
+		case 1: memcpy(p, &e->placeUsec, 4); break;
+		case 2: memcpy(p, &e->piece, 4); break;
+		case 3: memcpy(p, &e->shape, 2); break;
+		case 4: *p = (unsigned char)e->x; break;
+		case 5: *p = (unsigned char)e->y; break;
+		case 6: *p = e->type; break;
+		case 7: *p = e->lines; break;
+		case 8: *p = e->height; break;
+		case 9: *p = e->holes; break;
+		case 10: *p = e->inputs; break;
+		}
+		p += columnSize[column];
+	}
+	fwrite(values, 1, p - values, out);
+}
+
+static void write_batch(void)
+{
+	unsigned int n = batchCount;
+	long bytes = 8;
+
+	if(n == 0)
+		return;
+	if(!out)
+	{
+		stats.lost += n; // a new file would not open, the batch is thrown away
+		batchCount = 0;
+		return;
+	}
+
+	fwrite("BLK1", 1, 4, out);
+	fwrite(&n, 4, 1, out);
+	for(int c = 0; c < ANALYTICS_COLUMNS; c++)
+	{
+		write_column(c, n);
+		bytes += columnSize[c] * n;
+	}
+
+	fileBytes += bytes;
+	stats.bytesWritten += bytes;
+	stats.written += n;
+	batchCount = 0;
+
+	if(fileBytes >= rotateAt)
+	{
+		fclose(out);
+		if(!open_file())
+			out = NULL; // write_batch counts what follows as lost
+	}
+}
+
+static THREADPROC analytics_writer(void *arg)
+{
+	double lastWrite = time_usec();
+
+	(void)arg;
+
+	for(;;)
+	{
+		bool done = stopping;
+
+		while(atomic_acquire(&filled[tail % ANALYTICS_QUEUE]) == tail + 1)
+		{
+			batch[batchCount++] = ring[tail % ANALYTICS_QUEUE];
+			atomic_release(&tail, tail + 1); // hands the slot back to the games
+			if(batchCount == ANALYTICS_BATCH)
+			{
+				write_batch();
+				lastWrite = time_usec();
+			}
+		}
+
+		//a partial block at most once a second keeps the file current without tiny blocks
+		if(done || (batchCount > 0 && time_usec() - lastWrite > 1e6))
+		{
+			write_batch();
+			lastWrite = time_usec();
+		}
+		if(done)
+			break;
+		sleep_msec(20);
+	}
+	return 0;
+}
+
+// the lock hook while a log runs, for every game of every front end
+static void record_lock(const GameState *g, const Piece *locked, int lines)
+{
+	AnalyticsEvent e;
+
+	analytics_lock(&e, g, locked, lines);
+	analytics_record(&e);
+}
+
+bool analytics_start(const char *prefix, long rotateBytes)
+{
+	if(running)
+		return false;
+
+	strncpy(outPrefix, prefix, sizeof(outPrefix) - 1);
+	outPrefix[sizeof(outPrefix) - 1] = 0;
+	rotateAt = rotateBytes;
+	memset(&stats, 0, sizeof(stats));
+	memset((void*)filled, 0, sizeof(filled));
+	head = tail = 0;
+	dropped = 0;
+	batchCount = 0;
+	stopping = false;
+
+	if(!open_file())
+		return false;
+	if(!thread_create(&writer, analytics_writer, NULL))
+	{
+		fclose(out);
+		return false;
+	}
+	running = true;
+	set_lock_hook(record_lock);
+	return true;
+}
+
+void analytics_lock(AnalyticsEvent *e, const GameState *g, const Piece *locked, int lines)
+{
+	int x, y, height = 0, holes = 0;
+
+	e->tick = g->tick;
+	e->placeUsec = 0;
+	e->inputs = 0;
+	e->piece = g->pieces - 1;
+	e->shape = 0;
+	e->type = TILENODRAW;
+	for(x = 0; x < 4; x++)
+		for(y = 0; y < 4; y++)
+			if(locked->size[x][y] != TILENODRAW)
+			{
+				e->shape |= 1 << (x * 4 + y);
+				e->type = locked->size[x][y];
+			}
+	e->x = (signed char)locked->x;
+	e->y = (signed char)locked->y;
+	e->lines = (unsigned char)lines;
+
+	for(x = 0; x < MAPWIDTH; x++)
+	{
+		bool covered = false;
+
+		for(y = 0; y < MAPHEIGHT; y++)
+		{
+			if(g->map[x][y] != TILEBLACK)
+			{
+				if(!covered && MAPHEIGHT - y > height)
+					height = MAPHEIGHT - y;
+				covered = true;
+			}
+			else if(covered)
+				holes++;
+		}
+	}
+	e->height = (unsigned char)height;
+	e->holes = (unsigned char)holes;
+}
+
+void analytics_record(const AnalyticsEvent *e)
+{
+	long slot;
+
+	if(!running)
+		return;
+
+	//one locked operation per record, the claim; only a drop counts separately
+	do
+	{
+		slot = head;
+		if(slot - atomic_acquire(&tail) >= ANALYTICS_QUEUE)
+		{
+			atomic_add(&dropped, 1);
+			return;
+		}
+	}
+	while(!atomic_cas(&head, slot, slot + 1)); // another game took it first, try the next
+	ring[slot % ANALYTICS_QUEUE] = *e;
+	atomic_release(&filled[slot % ANALYTICS_QUEUE], slot + 1); // publishes the slot to the writer
+}
+
+void analytics_stop(void)
+{
+	if(!running)
+		return;
+
+	set_lock_hook(NULL);
+	stopping = true;
+	thread_join(writer);
+	if(out)
+		fclose(out);
+	out = NULL;
+	running = false;
+}
+
+bool analytics_running(void)
+{
+	return running;
+}
+
+void analytics_stats(AnalyticsStats *s)
+{
+	*s = stats;
+	s->dropped = atomic_acquire(&dropped);
+	s->recorded = atomic_acquire(&head) + s->dropped;
+}
+
+long analytics_export_csv(const char *path, const char *csvPath)
+{
+	static unsigned char columns[ANALYTICS_BATCH * 4 * ANALYTICS_COLUMNS];
+	static const char *names[ANALYTICS_COLUMNS] =
+		{ "tick", "place_usec", "piece", "shape", "x", "y", "type", "lines", "height", "holes", "inputs" };
+	FILE *in, *csv;
+	char magic[4];
+	unsigned int n;
+	long records = 0;
+
+	in = fopen(path, "rb");
+	if(!in)
+		return -1;
+	if(fread(magic, 1, 4, in) != 4 || memcmp(magic, "TPA1", 4) != 0)
+	{
+		fclose(in);
+		return -1;
+	}
+	csv = fopen(csvPath, "w");
+	if(!csv)
+	{
+		fclose(in);
+		return -1;
+	}
+
+	for(int c = 0; c < ANALYTICS_COLUMNS; c++)
+		fprintf(csv, c ? ",%s" : "%s", names[c]);
+	fprintf(csv, "\n");
+
+	while(fread(magic, 1, 4, in) == 4 && memcmp(magic, "BLK1", 4) == 0 &&
+		fread(&n, 4, 1, in) == 1 && n <= ANALYTICS_BATCH)
+	{
+		unsigned char *column[ANALYTICS_COLUMNS];
+		unsigned char *p = columns;
+		size_t size = 0;
+
+		for(int c = 0; c < ANALYTICS_COLUMNS; c++)
+		{
+			column[c] = p + size;
+			size += columnSize[c] * n;
+		}
+		if(fread(columns, 1, size, in) != size)
+			break;
+
+		for(unsigned int i = 0; i < n; i++)
+		{
+			unsigned int u32[3];
+			unsigned short shape;
+
+			for(int c = 0; c < 3; c++)
+				memcpy(&u32[c], column[c] + i * 4, 4);
+			memcpy(&shape, column[3] + i * 2, 2);
+			fprintf(csv, "%u,%u,%u,%u,%d,%d,%u,%u,%u,%u,%u\n", u32[0], u32[1], u32[2], shape,
+				(signed char)column[4][i], (signed char)column[5][i], column[6][i], column[7][i],
+				column[8][i], column[9][i], column[10][i]);
+		}
+		records += n;
+	}
+
+	fclose(csv);
+	fclose(in);
+	return records;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Game.h"
+
+// per piece analytics: while a log runs every lock_block, whichever front end
+// or thread steps the game, pushes one small record into a lock-free ring
+// through the engine's lock hook, and a writer thread batches them into a
+// columnar binary file, starting a new file once it passes the size limit. A
+// full ring drops and counts the record instead of blocking the game.
+//
+// File layout, little endian: "TPA1" then blocks of { "BLK1", record count n,
+// then each column in AnalyticsEvent order as n values of that field }.
+// A lock that clears rows is the line clear event, its lines column is > 0.
+
+#define ANALYTICS_QUEUE 4096 // records between the game and the writer, power of 2
+#define ANALYTICS_BATCH 1024 // records per column block
+#define ANALYTICS_COLUMNS 11
+
+struct AnalyticsEvent
+{
+	unsigned int tick; // game tick or clock of the lock
+	unsigned int placeUsec; // spawn to lock, 0 where the front end does not time pieces
+	unsigned int piece; // pieces spawned so far in this game
+	unsigned short shape; // filled cells of the 4x4 piece, bit i*4+j for size[i][j]
+	signed char x, y; // where it locked
+	unsigned char type; // TILE* colour of the piece
+	unsigned char lines; // rows cleared by this lock
+	unsigned char height; // stack height after the lock
+	unsigned char holes; // covered empty cells after the lock
+	unsigned char inputs; // moves and rotations spent on the piece, 0 where not counted
+};
+
+struct AnalyticsStats
+{
+	long recorded; // records accepted from the game
+	long dropped; // records lost because the ring was full
+	long lost; // records the writer threw away because a new file would not open
+	long written; // records in the files
+	int files;
+	double bytesWritten;
+};
+
+bool analytics_start(const char *prefix, long rotateBytes); //writes prefix000.tpa, prefix001.tpa... each up to about rotateBytes, sets the lock hook
+void analytics_lock(AnalyticsEvent *e, const GameState *g, const Piece *locked, int lines); //fills e for locked from g after the lock, placeUsec and inputs 0
+void analytics_record(const AnalyticsEvent *e); //any thread, never blocks
+void analytics_stop(void); //clears the lock hook, writes everything queued and closes the file
+bool analytics_running(void);
+void analytics_stats(AnalyticsStats *stats);
+long analytics_export_csv(const char *path, const char *csvPath); //records converted, -1 if path is not an analytics file
@@ -0,0 +1,25 @@
+// converts analytics logs to CSV without the game, e.g. on a Linux box:
+//   g++ -O2 AnalyticsCsv.cpp Analytics.cpp Game.cpp -lpthread -o tpa2csv
+//   ./tpa2csv analytics000.tpa analytics000.csv
+// the Windows build does the same with "TetrisGame.exe -analytics-csv in out"
+#include "Analytics.h"
+#include <stdio.h>
+
+int main(int argc, char **argv)
+{
+	long records;
+
+	if(argc != 3)
+	{
+		printf("usage: %s log.tpa out.csv\n", argv[0]);
+		return 1;
+	}
+	records = analytics_export_csv(argv[1], argv[2]);
+	if(records < 0)
+	{
+		printf("%s is not an analytics log\n", argv[1]);
+		return 1;
+	}
+	printf("%ld records\n", records);
+	return 0;
+}
@@ -0,0 +1,528 @@
+#include "Capture.h"
+#include "Threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct CaptureSlot
+{
+	unsigned char *pixels; // BGRX frame from the renderer
+	unsigned char *encoded; // YUV planes or PNG file for this frame
+	long frame; // frame number, orders the writes to the video file
+};
+
+// encoder state, only one capture runs at a time
+static CaptureSlot slots[CAPTURE_BUFFERS];
+static int freeSlots[CAPTURE_BUFFERS], freeCount; // slots the renderer may fill
+static int queue[CAPTURE_BUFFERS], queueHead, queueCount; // filled slots waiting for an encoder
+static Mutex lock; // the queue, free slots and stats, never held over disk I/O
+static Mutex writer; // puts the video frames in order, with written
+static CondVar queued, written, freed;
+static Thread threads[CAPTURE_MAXTHREADS];
+static int threadCount;
+static bool running = false, stopping;
+static FILE *video;
+static char outPath[260];
+static int outFormat, width, height;
+static long nextFrame, nextWrite;
+static CaptureStats stats;
+static double startTime;
+static unsigned long crcTable[256];
+
+// --- PNG writer, uncompressed deflate blocks so no zlib is needed ---
+
+static void init_crc(void)
+{
+	for(unsigned long n = 0; n < 256; n++)
+	{
+		unsigned long c = n;
+		for(int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+		crcTable[n] = c;
+	}
+}
+
+static unsigned long crc(unsigned long c, const unsigned char *buf, size_t len)
+{
+	c ^= 0xffffffffUL;
+	for(size_t i = 0; i < len; i++)
+		c = crcTable[(c ^ buf[i]) & 0xff] ^ (c >> 8);
+	return c ^ 0xffffffffUL;
+}
+
+static unsigned char* put32(unsigned char *p, unsigned long v)
+{
+	p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+	return p + 4;
+}
+
+// writes chunk type + data already at p + 8 and appends length and crc
+static unsigned char* finish_chunk(unsigned char *p, const char *type, size_t len)
+{
+	put32(p, (unsigned long)len);
+	memcpy(p + 4, type, 4);
+	return put32(p + 8 + len, crc(0, p + 4, len + 4));
+}
+
+static size_t png_size(void)
+{
+	size_t raw = (size_t)height * (1 + width * 3);
+	return 8 + 25 + 12 + 2 + raw + 5 * (raw / 65535 + 1) + 4 + 12;
+}
+
+// encodes a BGRX frame as a 24-bit PNG, returns the file size
+static size_t encode_png(const unsigned char *bgrx, unsigned char *out)
+{
+	static const unsigned char signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+	unsigned char *p = out, *idat, *d;
+	unsigned long a = 1, b = 0; // adler32
+	size_t raw = (size_t)height * (1 + width * 3), left = raw, block;
+	int row = 0, col = -1; // col -1 is the filter byte
+
+	memcpy(p, signature, 8);
+	p += 8;
+
+	put32(p + 8, width);
+	put32(p + 12, height);
+	p[16] = 8; p[17] = 2; p[18] = 0; p[19] = 0; p[20] = 0; // 8-bit RGB, no interlace
+	p = finish_chunk(p, "IHDR", 13);
+
+	idat = p;
+	d = p + 8;
+	*d++ = 0x78; *d++ = 0x01;
+	while(left > 0)
+	{
+		block = left > 65535 ? 65535 : left;
+		left -= block;
+		*d++ = left == 0 ? 1 : 0;
+		*d++ = (unsigned char)block; *d++ = (unsigned char)(block >> 8);
+		*d++ = (unsigned char)~block; *d++ = (unsigned char)(~block >> 8);
+
+		//filter byte 0 at the start of each row, then RGB from BGRX
+		for(size_t i = 0; i < block; i++)
+		{
+			unsigned char v;
+			if(col < 0)
+				v = 0;
+			else
+				v = bgrx[((size_t)row * width + col / 3) * 4 + 2 - col % 3];
+			if(++col == width * 3)
+			{
+				col = -1;
+				row++;
+			}
+			*d++ = v;
+			a = (a + v) % 65521;
+			b = (b + a) % 65521;
+		}
+	}
+	d = put32(d, (b << 16) | a);
+	p = finish_chunk(idat, "IDAT", d - (idat + 8));
+	p = finish_chunk(p, "IEND", 0);
+
+	return p - out;
+}
+
+// --- Y4M writer ---
+
+// BT.601 4:2:0, each chroma sample averages a 2x2 block
+static size_t encode_yuv(const unsigned char *bgrx, unsigned char *out)
+{
+	unsigned char *yp = out, *up = out + width * height, *vp = up + (width / 2) * (height / 2);
+	int x, y;
+
+	for(y = 0; y < height; y++)
+	{
+		const unsigned char *s = bgrx + (size_t)y * width * 4;
+		for(x = 0; x < width; x++, s += 4)
+			*yp++ = (unsigned char)(((66 * s[2] + 129 * s[1] + 25 * s[0] + 128) >> 8) + 16);
+	}
+
+	for(y = 0; y < height / 2; y++)
+	{
+		for(x = 0; x < width / 2; x++)
+		{
+			const unsigned char *s0 = bgrx + ((size_t)(y * 2) * width + x * 2) * 4, *s1 = s0 + width * 4;
+			int r = (s0[2] + s0[6] + s1[2] + s1[6]) >> 2;
+			int g = (s0[1] + s0[5] + s1[1] + s1[5]) >> 2;
+			int b = (s0[0] + s0[4] + s1[0] + s1[4]) >> 2;
+			*up++ = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+			*vp++ = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+		}
+	}
+
+	return (size_t)width * height * 3 / 2;
+}
+
+static THREADPROC encoder_thread(void *)
+{
+	for(;;)
+	{
+		int slot;
+		size_t size;
+		bool saved;
+		CaptureSlot *s;
+
+		mutex_lock(&lock);
+		while(queueCount == 0 && !stopping)
+			cond_wait(&queued, &lock);
+		if(queueCount == 0)
+		{
+			mutex_unlock(&lock);
+			break;
+		}
+		slot = queue[queueHead];
+		queueHead = (queueHead + 1) % CAPTURE_BUFFERS;
+		queueCount--;
+		mutex_unlock(&lock);
+
+		s = &slots[slot];
+		if(outFormat == CAPTURE_PNG)
+		{
+			char name[280];
+			FILE *f;
+
+			size = encode_png(s->pixels, s->encoded);
+			sprintf(name, "%s%06ld.png", outPath, s->frame);
+			f = fopen(name, "wb");
+			saved = f != NULL && fwrite(s->encoded, 1, size, f) == size;
+			if(f && fclose(f) != 0)
+				saved = false;
+			mutex_lock(&lock);
+		}
+		else
+		{
+			size = encode_yuv(s->pixels, s->encoded);
+
+			//frames must land in the video in order, under their own lock so a
+			//slow write holds up only the other encoders, never the renderer
+			mutex_lock(&writer);
+			while(nextWrite != s->frame)
+				cond_wait(&written, &writer);
+			saved = fputs("FRAME\n", video) >= 0 && fwrite(s->encoded, 1, size, video) == size;
+			nextWrite++;
+			cond_broadcast(&written);
+			mutex_unlock(&writer);
+			mutex_lock(&lock);
+		}
+
+		if(saved)
+		{
+			stats.encoded++;
+			stats.bytesWritten += (double)size;
+		}
+		else
+			stats.failed++;
+		freeSlots[freeCount++] = slot;
+		cond_signal(&freed);
+		mutex_unlock(&lock);
+	}
+	return 0;
+}
+
+// frees the buffers and closes the video, also cleans up a capture_start that failed part way
+static void release_buffers(void)
+{
+	for(int i = 0; i < CAPTURE_BUFFERS; i++)
+	{
+		free(slots[i].pixels);
+		free(slots[i].encoded);
+		slots[i].pixels = slots[i].encoded = NULL;
+	}
+	if(video)
+	{
+		fclose(video);
+		video = NULL;
+	}
+}
+
+bool capture_start(const char *path, int format, int w, int h, int fps, int threadsWanted)
+{
+	int i;
+	size_t encodedSize;
+
+	if(running || w <= 0 || h <= 0 || (w & 1) || (h & 1))
+		return false;
+
+	width = w;
+	height = h;
+	outFormat = format;
+	strncpy(outPath, path, sizeof(outPath) - 1);
+	outPath[sizeof(outPath) - 1] = 0;
+
+	if(format == CAPTURE_Y4M)
+	{
+		video = fopen(path, "wb");
+		if(!video)
+			return false;
+		fprintf(video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		encodedSize = (size_t)width * height * 3 / 2;
+	}
+	else
+	{
+		init_crc();
+		encodedSize = png_size();
+	}
+
+	for(i = 0; i < CAPTURE_BUFFERS; i++)
+	{
+		slots[i].pixels = (unsigned char*) malloc((size_t)width * height * 4);
+		slots[i].encoded = (unsigned char*) malloc(encodedSize);
+		freeSlots[i] = i;
+	}
+	for(i = 0; i < CAPTURE_BUFFERS; i++)
+	{
+		if(!slots[i].pixels || !slots[i].encoded)
+		{
+			release_buffers();
+			return false;
+		}
+	}
+	freeCount = CAPTURE_BUFFERS;
+	queueHead = queueCount = 0;
+	nextFrame = nextWrite = 0;
+	memset(&stats, 0, sizeof(stats));
+	startTime = time_usec();
+	stopping = false;
+
+	mutex_init(&lock);
+	mutex_init(&writer);
+	cond_init(&queued);
+	cond_init(&written);
+	cond_init(&freed);
+
+	if(threadsWanted < 1)
+		threadsWanted = 1;
+	if(threadsWanted > CAPTURE_MAXTHREADS)
+		threadsWanted = CAPTURE_MAXTHREADS;
+	for(threadCount = 0; threadCount < threadsWanted; threadCount++)
+		if(!thread_create(&threads[threadCount], encoder_thread, NULL))
+			break;
+	if(threadCount == 0)
+	{
+		cond_destroy(&queued);
+		cond_destroy(&written);
+		cond_destroy(&freed);
+		mutex_destroy(&writer);
+		mutex_destroy(&lock);
+		release_buffers();
+		return false;
+	}
+
+	running = true;
+	return true;
+}
+
+unsigned char* capture_acquire(void)
+{
+	unsigned char *pixels = NULL;
+
+	if(!running)
+		return NULL;
+
+	mutex_lock(&lock);
+	if(freeCount > 0)
+		pixels = slots[freeSlots[--freeCount]].pixels;
+	else
+		stats.dropped++;
+	mutex_unlock(&lock);
+
+	return pixels;
+}
+
+unsigned char* capture_acquire_wait(void)
+{
+	unsigned char *pixels;
+
+	if(!running)
+		return NULL;
+
+	mutex_lock(&lock);
+	while(freeCount == 0)
+		cond_wait(&freed, &lock);
+	pixels = slots[freeSlots[--freeCount]].pixels;
+	mutex_unlock(&lock);
+
+	return pixels;
+}
+
+void capture_submit(unsigned char *frame)
+{
+	int slot;
+
+	for(slot = 0; slot < CAPTURE_BUFFERS; slot++)
+		if(slots[slot].pixels == frame)
+			break;
+	if(slot == CAPTURE_BUFFERS)
+		return;
+
+	mutex_lock(&lock);
+	slots[slot].frame = nextFrame++;
+	queue[(queueHead + queueCount) % CAPTURE_BUFFERS] = slot;
+	queueCount++;
+	stats.captured++;
+	cond_signal(&queued);
+	mutex_unlock(&lock);
+}
+
+void capture_stop(void)
+{
+	int i;
+
+	if(!running)
+		return;
+
+	mutex_lock(&lock);
+	stopping = true;
+	cond_broadcast(&queued);
+	mutex_unlock(&lock);
+
+	for(i = 0; i < threadCount; i++)
+		thread_join(threads[i]);
+
+	release_buffers();
+	stats.seconds = (time_usec() - startTime) / 1e6;
+
+	cond_destroy(&queued);
+	cond_destroy(&written);
+	cond_destroy(&freed);
+	mutex_destroy(&writer);
+	mutex_destroy(&lock);
+	running = false;
+}
+
+bool capture_running(void)
+{
+	return running;
+}
+
+void capture_stats(CaptureStats *out)
+{
+	if(running)
+	{
+		mutex_lock(&lock);
+		*out = stats;
+		mutex_unlock(&lock);
+		out->seconds = (time_usec() - startTime) / 1e6;
+	}
+	else
+		*out = stats;
+}
+
+// --- headless frame source ---
+
+// one map cell of tile colour with a darker one pixel edge so cells stay apart
+static void draw_cell(unsigned char *frame, int cellX, int cellY, int tile)
+{
+	const unsigned char *rgb = tileColors[tile];
+
+	for(int y = 0; y < CAPTURE_CELL; y++)
+	{
+		unsigned char *p = frame + ((size_t)(cellY * CAPTURE_CELL + y) * CAPTURE_GAME_WIDTH + cellX * CAPTURE_CELL) * 4;
+
+		for(int x = 0; x < CAPTURE_CELL; x++, p += 4)
+		{
+			int shade = (x == 0 || y == 0 || x == CAPTURE_CELL - 1 || y == CAPTURE_CELL - 1) ? 2 : 1;
+
+			p[0] = (unsigned char)(rgb[2] / shade);
+			p[1] = (unsigned char)(rgb[1] / shade);
+			p[2] = (unsigned char)(rgb[0] / shade);
+			p[3] = 0;
+		}
+	}
+}
+
+void capture_draw_game(unsigned char *frame, const GameState *g)
+{
+	int i, j;
+
+	memset(frame, 0, (size_t)CAPTURE_GAME_WIDTH * CAPTURE_GAME_HEIGHT * 4);
+
+	//the board's right edge, the preview sits past it
+	for(j = 0; j < MAPHEIGHT; j++)
+		draw_cell(frame, MAPWIDTH, j, TILEGREY);
+
+	for(i = 0; i < MAPWIDTH; i++)
+		for(j = 0; j < MAPHEIGHT; j++)
+			if(g->map[i][j] != TILEBLACK && g->map[i][j] != TILENODRAW)
+				draw_cell(frame, i, j, g->map[i][j]);
+
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+		{
+			int x = g->piece.x + i, y = g->piece.y + j;
+
+			if(g->gameStarted && g->piece.size[i][j] != TILENODRAW && x >= 0 && x < MAPWIDTH && y >= 0 && y < MAPHEIGHT)
+				draw_cell(frame, x, y, g->piece.size[i][j]);
+			if(g->prePiece.size[i][j] != TILENODRAW)
+				draw_cell(frame, MAPWIDTH + 1 + i, 1 + j, g->prePiece.size[i][j]);
+		}
+}
+
+long capture_replay(const char *path, int format, unsigned int seed, const unsigned char *inputs, int ticks, int threads)
+{
+	GameState g;
+	CaptureStats s;
+	unsigned char *frame;
+
+	if(!capture_start(path, format, CAPTURE_GAME_WIDTH, CAPTURE_GAME_HEIGHT, TICKRATE, threads))
+		return -1;
+
+	init_game(&g, seed);
+	for(int t = 0; t <= ticks; t++)
+	{
+		if(t > 0)
+			step_game(&g, inputs[t - 1]);
+		frame = capture_acquire_wait();
+		capture_draw_game(frame, &g);
+		capture_submit(frame);
+		if(!g.gameStarted)
+			break; // the game over frame is the last
+	}
+
+	capture_stop();
+	capture_stats(&s);
+	return s.encoded;
+}
+
+int capture_main(const char *args)
+{
+	char in[260], out[260];
+	unsigned int seed;
+	unsigned char *inputs;
+	long size, ticks = 0, frames = -1;
+	CaptureStats s;
+	FILE *f;
+
+	if(sscanf(args, "%u %259s %259s", &seed, in, out) != 3)
+	{
+		printf("usage: capture seed inputs out.y4m|prefix\n");
+		return 1;
+	}
+	f = fopen(in, "rb");
+	if(!f)
+	{
+		printf("can't open %s\n", in);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	inputs = (unsigned char*)malloc(size + 1);
+	if(inputs)
+	{
+		ticks = (long)fread(inputs, 1, size, f);
+		frames = capture_replay(out, strstr(out, ".y4m") ? CAPTURE_Y4M : CAPTURE_PNG, seed, inputs, (int)ticks, cpu_count());
+		free(inputs);
+	}
+	fclose(f);
+	if(frames < 0)
+	{
+		printf("capture failed to start\n");
+		return 1;
+	}
+	capture_stats(&s);
+	printf("%ld ticks, %ld frames encoded, %ld failed, %.1f s\n", ticks, frames, s.failed, s.seconds);
+	return s.failed > 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Game.h"
+
+// frame capture: the render thread copies finished frames into recycled
+// buffers and a pool of encoder threads writes them out as a Y4M video or
+// a numbered PNG sequence. The render thread never waits on the encoders,
+// when every buffer is busy the frame is dropped and counted instead.
+//
+// capture_replay is the headless source: it steps a game through recorded
+// inputs and draws each tick flat with capture_draw_game, no window or
+// Direct3D, waiting on the encoders instead of dropping, so a replay encodes
+// as fast as they run.
+
+#define CAPTURE_Y4M 0 // one YUV4MPEG2 (4:2:0) video file
+#define CAPTURE_PNG 1 // path is a prefix, writes path000000.png, path000001.png...
+
+#define CAPTURE_BUFFERS 8 // recycled frame buffers, bounds memory and queue length
+#define CAPTURE_MAXTHREADS 8
+
+#define CAPTURE_CELL 16 // pixels per map cell in capture_draw_game
+#define CAPTURE_GAME_WIDTH ((MAPWIDTH + 6) * CAPTURE_CELL) // the board then a column for the preview
+#define CAPTURE_GAME_HEIGHT (MAPHEIGHT * CAPTURE_CELL)
+
+struct CaptureStats
+{
+	long captured; // frames handed to the encoders
+	long dropped; // frames skipped because no buffer was free
+	long encoded; // frames written to disk
+	long failed; // frames encoded but not written, a file that would not open or a short write
+	double seconds; // time since capture_start
+	double bytesWritten; // of the encoded frames only
+};
+
+bool capture_start(const char *path, int format, int width, int height, int fps, int threads); //opens the output, allocates the buffers and starts the encoders, false if any of it failed
+unsigned char* capture_acquire(void); //free 32-bit BGRX buffer of width*height pixels, NULL (and counted as dropped) if none
+unsigned char* capture_acquire_wait(void); //as capture_acquire but waits for an encoder to free a buffer, for offline sources
+void capture_submit(unsigned char *frame); //queues an acquired buffer for encoding
+void capture_stop(void); //encodes everything queued, stops the threads and closes the output
+bool capture_running(void);
+void capture_stats(CaptureStats *stats);
+void capture_draw_game(unsigned char *frame, const GameState *g); //draws g into a CAPTURE_GAME_WIDTH x CAPTURE_GAME_HEIGHT buffer
+long capture_replay(const char *path, int format, unsigned int seed, const unsigned char *inputs, int ticks, int threads); //init_game(seed) then step_game per input at TICKRATE fps, frames encoded or -1
+int capture_main(const char *args); //"seed inputs out.y4m|prefix", inputs one INPUT_* byte per tick, replays on every core and prints to stdout
@@ -0,0 +1,20 @@
+// encodes a recorded game without the window or Direct3D, e.g. on a Linux box:
+//   g++ -O2 CaptureMain.cpp Capture.cpp Game.cpp -lpthread -o tpcapture
+//   ./tpcapture 42 game.inputs game.y4m       (or a prefix for game000000.png...)
+// the inputs file holds one INPUT_* byte per tick of a game started with init_game(seed)
+// the Windows build does the same with "TetrisGame.exe -capture-replay 42 game.inputs game.y4m"
+#include "Capture.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+	char args[600] = "";
+
+	for(int i = 1; i < argc; i++)
+	{
+		strncat(args, argv[i], sizeof(args) - strlen(args) - 2);
+		strcat(args, " ");
+	}
+	return capture_main(args);
+}
@@ -0,0 +1,350 @@
+#include "Game.h"
+#include "Profiler.h"
+#include <string.h>
+
+static LockHook lockHook; // see set_lock_hook
+
+// same sequence as the C runtime rand(), but kept in the state so games replay exactly
+int next_random(GameState *g)
+{
+	g->seed = g->seed * 214013 + 2531011;
+	return (g->seed >> 16) & 0x7fff;
+}
+
+// fills p with one of the 7 block types
+void make_piece(Piece *p, int type)
+{
+	int i,j;
+
+	//clear the piece
+	p->rotation = 0;
+	for(i = 0; i < 4; ++i)
+		for(j = 0; j < 4; ++j)
+			p->size[i][j] = TILENODRAW;
+
+	// have 7 different types of blocks: tower(red),box(blue),pyramid(green),
+	// leftlean(yellow),rightlean(orange),leftknight(purple),rightknight(aqua)
+	switch(type)
+	{
+	case 0: //Tower
+		p->size[1][0] = TILERED;
+		p->size[1][1] = TILERED;
+		p->size[1][2] = TILERED;
+		p->size[1][3] = TILERED;
+		break;
+	case 1: //BOX
+		p->size[1][1] = TILEBLUE;
+		p->size[2][1] = TILEBLUE;
+		p->size[1][2] = TILEBLUE;
+		p->size[2][2] = TILEBLUE;
+		break;
+	case 2: //Pyramid
+		p->size[1][1] = TILEGREEN;
+		p->size[1][2] = TILEGREEN;
+		p->size[0][2] = TILEGREEN;
+		p->size[2][2] = TILEGREEN;
+		break;
+	case 3: //Left Lean
+		p->size[1][1] = TILEYELLOW;
+		p->size[2][1] = TILEYELLOW;
+		p->size[2][2] = TILEYELLOW;
+		p->size[3][2] = TILEYELLOW;
+		break;
+	case 4: //Right Lean
+		p->size[2][1] = TILEORANGE;
+		p->size[3][1] = TILEORANGE;
+		p->size[1][2] = TILEORANGE;
+		p->size[2][2] = TILEORANGE;
+		break;
+	case 5: //Left Knight
+		p->size[1][1] = TILEPURPLE;
+		p->size[2][1] = TILEPURPLE;
+		p->size[2][2] = TILEPURPLE;
+		p->size[2][3] = TILEPURPLE;
+		break;
+	case 6: //Right Knight
+		p->size[2][1] = TILEAQUA;
+		p->size[1][1] = TILEAQUA;
+		p->size[1][2] = TILEAQUA;
+		p->size[1][3] = TILEAQUA;
+		break;
+	}
+}
+
+int piece_type(const Piece *p)
+{
+	// each type has its own colour, in make_piece order
+	static const int types[TILEAQUA + 1] = { -1, -1, 1, 2, 0, 3, 4, 5, -1, 6 };
+
+	for(int i = 0; i < 4; i++)
+		for(int j = 0; j < 4; j++)
+			if(p->size[i][j] != TILENODRAW)
+				return types[p->size[i][j]];
+	return -1;
+}
+
+void init_game(GameState *g, unsigned int seed)
+{
+	reset_game(g, seed);
+	create_block(g);
+}
+
+void reset_game(GameState *g, unsigned int seed)
+{
+	memset(g, 0, sizeof(GameState));
+	g->seed = seed;
+
+	//initialize map to all black
+	for(int x = 0; x < MAPWIDTH; x++)
+	{
+		for(int y = 0; y < MAPHEIGHT + 1; y++)
+		{
+			if(y == MAPHEIGHT)
+				g->map[x][y] = TILEGREY;
+			else
+				g->map[x][y] = TILEBLACK;
+		}
+	}
+}
+
+void create_block(GameState *g)
+{
+	PROFILE_SCOPE(PROFILE_SPAWN);
+
+	//case for if we need to generate preview and current piece
+	if(g->gameStarted == false)
+	{
+		make_piece(&g->piece, next_random(g) % 7);
+		g->gameStarted = true;
+	}
+	else
+		g->piece = g->prePiece;
+
+	g->piece.x = MAPWIDTH/2 - 2;
+	g->piece.y = 0;
+	g->pieces++;
+
+	// NOW we create the preview piece!
+	make_piece(&g->prePiece, next_random(g) % 7);
+	g->prePiece.x = MAPWIDTH + 2;
+	g->prePiece.y = MAPHEIGHT - 4;
+}
+
+void move_block(GameState *g, int x, int y)
+{
+	//if there is a collision
+	if(check_collision(g,x,y))
+	{
+		//if we were moving down
+		if(y > 0)
+		{
+			//if at top of the screen
+			if(g->piece.y < 1)
+			{
+				game_over(g);
+			}
+			else // add this to the map
+			{
+				lock_block(g);
+				create_block(g);
+			}
+		}
+	}
+	else
+	{
+		g->piece.x+=x;
+		g->piece.y+=y;
+	}
+}
+
+// removes every full row
+static void clear_rows(GameState *g)
+{
+	PROFILE_SCOPE(PROFILE_LINECLEAR);
+	int i,j;
+
+	for(j = 0; j < MAPHEIGHT; j++)
+	{
+		bool filled = true;
+		for(i = 0; i < MAPWIDTH; i++)
+		{
+			if(g->map[i][j] == TILEBLACK)
+			{
+				filled = false;
+				break;
+			}
+		}
+
+		if(filled)
+		{
+			remove_row(g, j);
+			g->lines++;
+		}
+
+	}
+}
+
+LockHook set_lock_hook(LockHook hook)
+{
+	LockHook previous = lockHook;
+
+	lockHook = hook;
+	return previous;
+}
+
+void lock_block(GameState *g)
+{
+	PROFILE_SCOPE(PROFILE_LOCK);
+	int i,j;
+	int lines = g->lines;
+
+	if(g->piece.y < 5)
+		g->danger = true;
+
+	for(i = 0; i < 4; ++i)
+	{
+		for(j = 0; j < 4; ++j)
+		{
+			if(g->piece.size[i][j] != TILENODRAW)
+			{
+				g->map[g->piece.x + i][g->piece.y + j] = g->piece.size[i][j];
+			}
+		}
+	}
+
+	// perhaps a row has been cleared?
+	clear_rows(g);
+
+	if(lockHook)
+		lockHook(g, &g->piece, g->lines - lines);
+}
+
+void game_over(GameState *g)
+{
+	g->gameStarted = false;
+}
+
+void remove_row(GameState *g, int row)
+{
+	int x,y;
+
+	for(x = 0; x < MAPWIDTH; x++)
+	{
+		for(y = row; y > 0; y--)
+		{
+			g->map[x][y] = g->map[x][y - 1];
+			if(y == 5)
+				if(g->map[x][y] == TILEBLACK)
+					g->danger = false;
+		}
+	}
+}
+
+int rotate_block(GameState *g)
+{
+	PROFILE_SCOPE(PROFILE_ROTATION);
+	int i, j;
+	unsigned char temp[4][4];
+
+	//copy &rotate the piece to the temporary array
+	for(i=0; i<4; i++)
+		for(j=0; j<4; j++)
+			temp[3-j][ i ]=g->piece.size[ i ][j];
+
+	//check collision of the temporary array with map borders and the blocks on the map
+	for(i=0; i<4; i++)
+		for(j=0; j<4; j++)
+			if(temp[ i ][j] != TILENODRAW)
+			{
+				if(g->piece.x + i < 0 || g->piece.x + i > MAPWIDTH - 1 ||
+					g->piece.y + j < 0 || g->piece.y + j > MAPHEIGHT - 1)
+					return 0;
+				if(g->map[g->piece.x + i][g->piece.y + j] != TILEBLACK)
+					return 0;
+			}
+
+	//successful!  copy the rotated temporary array to the original piece
+	memcpy(g->piece.size, temp, sizeof(temp));
+	g->piece.rotation = (g->piece.rotation + 1) & 3;
+	return 1;
+}
+
+//check if piece moved by x and y if it will collide with walls or other blocks
+int check_collision(const GameState *g, int nx, int ny)
+{
+	PROFILE_SCOPE(PROFILE_COLLISION);
+	int nextx = g->piece.x + nx;
+	int nexty = g->piece.y + ny;
+	int i,j;
+
+	//only the filled parts of the piece can hit the walls or other blocks
+	for(i = 0; i < 4; i++)
+	{
+		for(j = 0; j < 4; j++)
+		{
+			if(g->piece.size[i][j] != TILENODRAW)
+			{
+				if(nextx + i < 0 || nextx + i > MAPWIDTH - 1 || 
+						nexty + j < 0 || nexty + j > MAPHEIGHT - 1)
+						return 1;
+				if(g->map[nextx + i][nexty + j] != TILEBLACK)
+					return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void step_game(GameState *g, int input)
+{
+	if(!g->gameStarted)
+		return;
+
+	g->tick++;
+	g->score++;
+
+	if(input & INPUT_ROTATE)
+		rotate_block(g);
+	if(input & INPUT_LEFT)
+		move_block(g,-1,0);
+	if(input & INPUT_RIGHT)
+		move_block(g,1,0);
+	if(input & INPUT_DOWN)
+		move_block(g,0,1);
+
+	if(++g->gravityTicks >= GRAVITYTICKS)
+	{
+		g->gravityTicks = 0;
+		move_block(g,0,1);
+	}
+}
+
+static unsigned int fnv(unsigned int h, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char*) data;
+
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+unsigned int hash_game(const GameState *g)
+{
+	unsigned int h = 2166136261u;
+	int fields[14];
+
+	// field by field so struct padding never reaches the hash
+	fields[0] = g->piece.x; fields[1] = g->piece.y;
+	fields[2] = g->gameStarted; fields[3] = g->danger;
+	fields[4] = (int)g->seed; fields[5] = g->gravityTicks;
+	fields[6] = g->score; fields[7] = (int)g->tick;
+	fields[8] = g->bag; fields[9] = g->lockTicks; fields[10] = g->lockResets;
+	fields[11] = g->piece.rotation;
+	fields[12] = g->pieces; fields[13] = g->lines;
+
+	h = fnv(h, g->map, sizeof(g->map));
+	h = fnv(h, g->piece.size, sizeof(g->piece.size));
+	h = fnv(h, g->prePiece.size, sizeof(g->prePiece.size));
+	return fnv(h, fields, sizeof(fields));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+// game rules, kept apart from the window and Direct3D code so a game can be
+// copied, stepped and compared on its own (rollback, bots, servers)
+
+// falling block height/width/size declarations
+#define TILESIZE 2
+#define MAPHEIGHT 20
+#define MAPWIDTH 10
+#define TILEBLACK 0
+#define TILENODRAW 1
+#define TILEBLUE 2
+#define TILEGREEN 3
+#define TILERED 4
+#define TILEYELLOW 5
+#define TILEORANGE 6
+#define TILEPURPLE 7
+#define TILEGREY 8
+#define TILEAQUA 9
+
+// colour of each tile for every renderer, TILEBLACK and TILENODRAW are never drawn
+static const unsigned char tileColors[TILEAQUA + 1][3] =
+{
+	{ 0, 0, 0 }, { 0, 0, 0 },
+	{ 10, 10, 255 }, // blue
+	{ 10, 255, 10 }, // green
+	{ 255, 10, 10 }, // red
+	{ 255, 255, 10 }, // yellow
+	{ 255, 150, 10 }, // orange
+	{ 255, 10, 255 }, // purple
+	{ 140, 140, 140 }, // grey
+	{ 90, 255, 255 }, // aqua
+};
+
+// fixed step simulation used by step_game
+#define TICKRATE 60 // ticks per second
+#define GRAVITYTICKS 60 // ticks between gravity steps, the 1 sec of game_timer
+
+// input bits for step_game
+#define INPUT_LEFT 1
+#define INPUT_RIGHT 2
+#define INPUT_DOWN 4
+#define INPUT_ROTATE 8
+
+struct Piece { unsigned char size[4][4]; int x, y; int rotation; }; // represents a tetris piece, rotation counts quarter turns 0..3
+
+// everything needed to continue a game, plain data so it can be copied with =
+struct GameState
+{
+	unsigned char map[MAPWIDTH][MAPHEIGHT + 1];
+	Piece piece; // current piece being moved
+	Piece prePiece; // preview of next piece
+	bool gameStarted;
+	bool danger; // stack is near the top
+	unsigned int seed; // randomizer state
+	int gravityTicks; // ticks since the last gravity step
+	int score;
+	int pieces; // pieces spawned
+	int lines; // lines cleared
+	unsigned int tick;
+	unsigned char bag; // piece types already dealt from the current bag, for bag randomizers
+	int lockTicks; // ticks resting on the stack, for lock delay
+	int lockResets; // lock delay restarts used by the current piece
+};
+
+void init_game(GameState *g, unsigned int seed); //create new game
+void reset_game(GameState *g, unsigned int seed); //empty map and no piece yet, init_game without the first create_block
+void create_block(GameState *g); //create new block of struct piece
+void make_piece(Piece *p, int type); //fills p with block type 0..6
+int piece_type(const Piece *p); //type 0..6 make_piece built p from, -1 if empty
+int next_random(GameState *g); //next value of the game's own rand(), 0..32767
+void move_block(GameState *g, int x, int y); // move the current block
+void lock_block(GameState *g); //copies the current block into the map and clears full rows
+int check_collision(const GameState *g, int x, int y); // check if current block will collide with others (helper to move)
+int rotate_block(GameState *g); //rotates block, 0 if it did not fit
+void remove_row(GameState *g, int row); //removes row
+void game_over(GameState *g); // ends the game
+void step_game(GameState *g, int input); //one fixed tick: applies INPUT_* bits then gravity
+unsigned int hash_game(const GameState *g); //FNV-1a of the state, equal states hash equal
+
+// called by lock_block for every lock of every game, g is after the line clear and before the next piece spawns
+typedef void (*LockHook)(const GameState *g, const Piece *locked, int lines);
+LockHook set_lock_hook(LockHook hook); //NULL for none, returns the previous hook. Set it while no game is stepping
@@ -0,0 +1,288 @@
+#include "Metrics.h"
+#include "Sockets.h"
+#include "Threads.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+struct Metric
+{
+	const char *name, *help;
+	int type;
+	volatile long long value; // counter or gauge value, histogram count
+	volatile long long sumNs; // histogram sum in nanoseconds
+	volatile long buckets[HISTOGRAM_BUCKETS];
+};
+
+static Metric metrics[METRICS_MAX];
+static volatile long metricCount = 0;
+
+static Thread serverThread, snapshotThread;
+static SOCKET listener = INVALID_SOCKET;
+static volatile bool serving = false, snapshotting = false;
+static char snapshotPath[260];
+static int snapshotSeconds;
+
+int metric_register(const char *name, const char *help, int type)
+{
+	int id;
+
+	if(metricCount >= METRICS_MAX)
+		return -1;
+
+	id = metricCount;
+	memset(&metrics[id], 0, sizeof(Metric));
+	metrics[id].name = name;
+	metrics[id].help = help;
+	metrics[id].type = type;
+	atomic_add(&metricCount, 1); // publish only once filled in
+	return id;
+}
+
+void metric_add(int id, long long n)
+{
+	if(id >= 0)
+		atomic_add64(&metrics[id].value, n);
+}
+
+void metric_set(int id, long long value)
+{
+	if(id >= 0)
+		atomic_store64(&metrics[id].value, value);
+}
+
+// bucket b covers [2^e * (1 + s/SUB), 2^e * (1 + (s+1)/SUB)) nanoseconds with e = b / SUB, s = b % SUB,
+// so a sub-microsecond tick or lock time keeps its 1/8 resolution
+static int bucket_index(double nsec)
+{
+	int e, b;
+	double m;
+
+	if(nsec < 1.0)
+		return 0;
+	m = frexp(nsec, &e); // nsec = m * 2^e, m in [0.5, 1)
+	b = (e - 1) * HISTOGRAM_SUB + (int)((m * 2.0 - 1.0) * HISTOGRAM_SUB);
+	return b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1;
+}
+
+static double bucket_upper(int b)
+{
+	return ldexp(1.0 + (double)(b % HISTOGRAM_SUB + 1) / HISTOGRAM_SUB, b / HISTOGRAM_SUB);
+}
+
+void metric_observe(int id, double usec)
+{
+	if(id < 0)
+		return;
+	atomic_add(&metrics[id].buckets[bucket_index(usec * 1000.0)], 1);
+	atomic_add64(&metrics[id].sumNs, (long long)(usec * 1000.0));
+	atomic_add64(&metrics[id].value, 1);
+}
+
+double metric_quantile(int id, double q)
+{
+	long counts[HISTOGRAM_BUCKETS];
+	long long total = 0, seen = 0;
+	int b;
+
+	if(id < 0)
+		return 0.0;
+
+	// copy first so the walk sees one consistent total
+	for(b = 0; b < HISTOGRAM_BUCKETS; b++)
+	{
+		counts[b] = metrics[id].buckets[b];
+		total += counts[b];
+	}
+	if(total == 0)
+		return 0.0;
+
+	for(b = 0; b < HISTOGRAM_BUCKETS; b++)
+	{
+		seen += counts[b];
+		if(seen >= q * total)
+			break;
+	}
+	return bucket_upper(b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS - 1) / 1000.0;
+}
+
+// printf at buf + *n without running past size, old MSVC has no C99 snprintf
+static void append(char *buf, int size, int *n, const char *fmt, ...)
+{
+	va_list args;
+	int room = size - *n, len;
+
+	if(room <= 1)
+		return;
+
+	va_start(args, fmt);
+#ifdef _MSC_VER
+	len = _vsnprintf(buf + *n, room - 1, fmt, args);
+#else
+	len = vsnprintf(buf + *n, room, fmt, args);
+#endif
+	va_end(args);
+
+	*n = (len < 0 || len >= room - 1) ? size - 1 : *n + len;
+	buf[*n] = 0;
+}
+
+int metrics_format(char *buf, int size)
+{
+	static const char *types[] = { "counter", "gauge", "summary" };
+	static const double quantiles[] = { 0.5, 0.99, 0.999 };
+	int i, q, n = 0, count = metricCount;
+
+	buf[0] = 0;
+	for(i = 0; i < count; i++)
+	{
+		Metric *m = &metrics[i];
+
+		append(buf, size, &n, "# HELP %s %s\n# TYPE %s %s\n", m->name, m->help, m->name, types[m->type]);
+		if(m->type != METRIC_HISTOGRAM)
+		{
+			append(buf, size, &n, "%s %lld\n", m->name, atomic_load64(&m->value));
+			continue;
+		}
+
+		for(q = 0; q < 3; q++)
+			append(buf, size, &n, "%s{quantile=\"%g\"} %g\n", m->name, quantiles[q], metric_quantile(i, quantiles[q]));
+		append(buf, size, &n, "%s_sum %.3f\n%s_count %lld\n", m->name,
+			atomic_load64(&m->sumNs) / 1000.0, m->name, atomic_load64(&m->value));
+	}
+	return n;
+}
+
+static THREADPROC server_thread(void *)
+{
+	static char body[16384], reply[16640];
+
+	while(serving)
+	{
+		fd_set readable;
+		struct timeval timeout = { 0, 250000 }; // wake up to check serving
+		char request[1024];
+		SOCKET client;
+		int len, bodyLen;
+
+		FD_ZERO(&readable);
+		FD_SET(listener, &readable);
+		if(select((int)listener + 1, &readable, NULL, NULL, &timeout) <= 0)
+			continue;
+
+		client = accept(listener, NULL, NULL);
+		if(client == INVALID_SOCKET)
+			continue;
+
+		//a client that connects and sends nothing must not hold up metrics_shutdown
+		socket_timeout(client, 250);
+		len = recv(client, request, sizeof(request) - 1, 0);
+		request[len > 0 ? len : 0] = 0;
+
+		if(strncmp(request, "GET /metrics", 12) == 0)
+		{
+			bodyLen = metrics_format(body, sizeof(body));
+			len = sprintf(reply, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", bodyLen);
+			memcpy(reply + len, body, bodyLen);
+			len += bodyLen;
+		}
+		else
+			len = sprintf(reply, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+
+		send(client, reply, len, 0);
+		socket_close(client);
+	}
+	return 0;
+}
+
+bool metrics_serve(int port)
+{
+	struct sockaddr_in addr;
+	int reuse = 1;
+
+	if(serving || !socket_startup())
+		return false;
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener == INVALID_SOCKET)
+		return false;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local only
+
+	if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 4) != 0)
+	{
+		socket_close(listener);
+		listener = INVALID_SOCKET;
+		return false;
+	}
+
+	serving = true;
+	if(!thread_create(&serverThread, server_thread, NULL))
+	{
+		serving = false;
+		socket_close(listener);
+		listener = INVALID_SOCKET;
+		return false;
+	}
+	return true;
+}
+
+static THREADPROC snapshot_thread(void *)
+{
+	static char body[16384];
+	int waited = 0;
+
+	while(snapshotting)
+	{
+		sleep_msec(100);
+		waited += 100;
+		if(waited < snapshotSeconds * 1000 && snapshotting)
+			continue;
+		waited = 0;
+
+		FILE *f = fopen(snapshotPath, "w");
+		if(f)
+		{
+			fwrite(body, 1, metrics_format(body, sizeof(body)), f);
+			fclose(f);
+		}
+	}
+	return 0;
+}
+
+bool metrics_snapshot(const char *path, int seconds)
+{
+	if(snapshotting || seconds < 1)
+		return false;
+
+	strncpy(snapshotPath, path, sizeof(snapshotPath) - 1);
+	snapshotSeconds = seconds;
+	snapshotting = true;
+	if(!thread_create(&snapshotThread, snapshot_thread, NULL))
+	{
+		snapshotting = false;
+		return false;
+	}
+	return true;
+}
+
+void metrics_shutdown(void)
+{
+	if(serving)
+	{
+		serving = false;
+		thread_join(serverThread);
+		socket_close(listener);
+		listener = INVALID_SOCKET;
+	}
+	if(snapshotting)
+	{
+		snapshotting = false; // the thread writes one last snapshot on the way out
+		thread_join(snapshotThread);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// metrics registry: counters, gauges and log-bucketed latency histograms.
+// Counter and gauge updates are one atomic operation and an observation three
+// (bucket, sum and count), so the game loop never takes a lock.
+// The registry can be served in Prometheus text format on a local port
+// and/or written to a file every few seconds.
+
+#define METRICS_MAX 32
+#define HISTOGRAM_SUB 8 // buckets per power of two, so quantiles are within 1/8
+#define HISTOGRAM_BUCKETS (35 * HISTOGRAM_SUB) // kept in nanoseconds, 1 ns up to 2^35 ns (34 sec)
+
+#define METRIC_COUNTER 0
+#define METRIC_GAUGE 1
+#define METRIC_HISTOGRAM 2
+
+int metric_register(const char *name, const char *help, int type); //returns the metric id, -1 when the registry is full
+void metric_add(int id, long long n); //counters
+void metric_set(int id, long long value); //gauges
+void metric_observe(int id, double usec); //histograms, value in microseconds
+double metric_quantile(int id, double q); //histogram quantile in microseconds, q from 0 to 1
+int metrics_format(char *buf, int size); //Prometheus text format, returns the length written
+bool metrics_serve(int port); //serves /metrics on 127.0.0.1:port from a background thread
+bool metrics_snapshot(const char *path, int seconds); //rewrites path with the registry every few seconds
+void metrics_shutdown(void); //stops the server and snapshot threads
@@ -0,0 +1,445 @@
+#include "Perft.h"
+#include "Profiler.h"
+#include "Threads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXCHILDREN 256 // distinct placements of one piece
+#define PERFT_MAXTHREADS 64
+#define BOARD_BITS 20 // boards followed per depth when deduplicating, 40 MB
+#define SET_BITS 22 // hash slots per depth, 32 MB, filled to 3/4 at most
+
+static const char pieceLetters[] = "IOTZSLJ"; // make_piece types 0..6
+
+// cells of a board, bit x of rows[y] set when map[x][y] is filled
+struct PerftBoard { unsigned short rows[MAPHEIGHT]; };
+
+struct PerftJob
+{
+	int sequence[PERFT_MAXDEPTH + 1];
+	int depth;
+	volatile long next; // next root or board to hand out
+
+	// path counting: the first placements, shared out to the threads
+	GameState roots[MAXCHILDREN];
+	int rootCount;
+
+	// dedup: the boards of one depth, and the hashes and boards of the next
+	int level;
+	PerftBoard *current, *following;
+	long currentCount;
+	volatile long followingCount; // new boards the game goes on from
+	volatile long ended; // new boards that ended the game
+	volatile long long *set; // board hashes, 0 when unused
+	volatile long full; // set past its limit
+};
+
+struct PerftContext
+{
+	PerftJob *job;
+	Thread thread;
+	long long counts[PERFT_MAXDEPTH + 1];
+	long long placements;
+	bool overflow; // a piece had more than MAXCHILDREN placements
+	GameState children[PERFT_MAXDEPTH][MAXCHILDREN];
+};
+
+static void spawn(GameState *g, int type, int next)
+{
+	make_piece(&g->piece, type);
+	g->piece.x = MAPWIDTH/2 - 2;
+	g->piece.y = 0;
+	make_piece(&g->prePiece, next);
+	g->prePiece.x = MAPWIDTH + 2;
+	g->prePiece.y = MAPHEIGHT - 4;
+}
+
+static void pack(const GameState *g, PerftBoard *b)
+{
+	for(int y = 0; y < MAPHEIGHT; y++)
+	{
+		unsigned short row = 0;
+
+		for(int x = 0; x < MAPWIDTH; x++)
+			if(g->map[x][y] != TILEBLACK)
+				row |= 1 << x;
+		b->rows[y] = row;
+	}
+}
+
+// colours are lost, they never change what the rules allow
+static void unpack(const PerftBoard *b, GameState *g)
+{
+	reset_game(g, 1);
+	g->gameStarted = true;
+	for(int y = 0; y < MAPHEIGHT; y++)
+		for(int x = 0; x < MAPWIDTH; x++)
+			if(b->rows[y] & (1 << x))
+				g->map[x][y] = TILEGREY;
+}
+
+// never 0, so 0 can mark an empty slot
+static unsigned long long board_hash(const PerftBoard *b, bool ended)
+{
+	unsigned long long h = ended ? 0x6a09e667f3bcc909ull : 0xcbf29ce484222325ull;
+
+	for(int y = 0; y < MAPHEIGHT; y++)
+		h = (h ^ b->rows[y]) * 0x9e3779b97f4a7c15ull;
+	h ^= h >> 31;
+	h *= 0xbf58476d1ce4e5b9ull;
+	h ^= h >> 29;
+	return h ? h : 1;
+}
+
+// every distinct board g's piece can lock into, found by flood filling the
+// engine's own moves from where the piece is. Returns how many went to children,
+// at most MAXCHILDREN; sets *overflow if there were more
+static int expand(const GameState *g, GameState *children, bool *overflow)
+{
+	GameState scratch = *g, spare;
+	Piece queue[4 * (MAPWIDTH + 3) * MAPHEIGHT];
+	unsigned int seen[4][MAPWIDTH + 3]; // bit y for each rotation and x + 3
+	unsigned long long hashes[MAXCHILDREN];
+	int head = 0, tail = 0, count = 0;
+
+	if(check_collision(g, 0, 0))
+		return 0; // spawned inside the stack
+	memset(seen, 0, sizeof(seen));
+	queue[tail++] = g->piece;
+	seen[g->piece.rotation][g->piece.x + 3] = 1u << g->piece.y;
+
+	while(head < tail)
+	{
+		//rotate, left, right, down
+		for(int m = 0; m < 4; m++)
+		{
+			Piece *p = &scratch.piece;
+
+			*p = queue[head];
+			if(m == 3 && check_collision(&scratch, 0, 1))
+			{
+				GameState *child = count < MAXCHILDREN ? &children[count] : &spare;
+				PerftBoard b;
+				unsigned long long h;
+				int i;
+
+				//lock the engine's way: rows cleared, the next piece spawned or the game ended
+				*child = *g;
+				child->piece = *p;
+				move_block(child, 0, 1);
+				pack(child, &b);
+				h = board_hash(&b, !child->gameStarted);
+				for(i = 0; i < count && hashes[i] != h; i++)
+					;
+				if(i == count && count < MAXCHILDREN)
+					hashes[count++] = h;
+				else if(i == count)
+					*overflow = true; // a new board with no room left for it
+				continue;
+			}
+			if(m == 0)
+				rotate_block(&scratch);
+			else
+				move_block(&scratch, m == 1 ? -1 : m == 2 ? 1 : 0, m == 3);
+
+			if(!(seen[p->rotation][p->x + 3] & (1u << p->y)))
+			{
+				seen[p->rotation][p->x + 3] |= 1u << p->y;
+				queue[tail++] = *p;
+			}
+		}
+		head++;
+	}
+	return count;
+}
+
+static void count_paths(PerftContext *c, GameState *g, int level)
+{
+	GameState *children = c->children[level];
+	int n = expand(g, children, &c->overflow);
+
+	c->placements += n;
+	c->counts[level + 1] += n;
+	if(level + 1 == c->job->depth)
+		return;
+	for(int i = 0; i < n; i++)
+		if(children[i].gameStarted)
+		{
+			spawn(&children[i], c->job->sequence[level + 1], c->job->sequence[level + 2]);
+			count_paths(c, &children[i], level + 1);
+		}
+}
+
+static THREADPROC paths_worker(void *arg)
+{
+	PerftContext *c = (PerftContext*)arg;
+	PerftJob *job = c->job;
+
+	for(;;)
+	{
+		int i = atomic_add(&job->next, 1) - 1;
+		GameState g;
+
+		if(i >= job->rootCount)
+			break;
+		g = job->roots[i];
+		if(job->depth > 1 && g.gameStarted)
+		{
+			spawn(&g, job->sequence[1], job->sequence[2]);
+			count_paths(c, &g, 1);
+		}
+	}
+	return 0;
+}
+
+// true the first time h is added
+static bool set_insert(volatile long long *set, unsigned long long h)
+{
+	unsigned long mask = (1ul << SET_BITS) - 1;
+
+	for(unsigned long i = (unsigned long)h & mask;; i = (i + 1) & mask)
+	{
+		long long slot = set[i];
+
+		if(slot == (long long)h)
+			return false;
+		if(slot == 0)
+		{
+			if(atomic_cas64(&set[i], 0, (long long)h))
+				return true;
+			if(set[i] == (long long)h)
+				return false; // another thread added the same board
+		}
+	}
+}
+
+static THREADPROC levels_worker(void *arg)
+{
+	PerftContext *c = (PerftContext*)arg;
+	PerftJob *job = c->job;
+	bool last = job->level + 1 == job->depth;
+
+	for(;;)
+	{
+		long i = atomic_add(&job->next, 1) - 1;
+		GameState g;
+		int n;
+
+		if(i >= job->currentCount || job->full)
+			break;
+		unpack(&job->current[i], &g);
+		spawn(&g, job->sequence[job->level], job->sequence[job->level + 1]);
+		n = expand(&g, c->children[0], &c->overflow);
+		c->placements += n;
+
+		for(int k = 0; k < n; k++)
+		{
+			GameState *child = &c->children[0][k];
+			PerftBoard b;
+
+			if(job->followingCount + job->ended >= (3l << SET_BITS) / 4)
+			{
+				job->full = 1;
+				break;
+			}
+			pack(child, &b);
+			if(!set_insert(job->set, board_hash(&b, !child->gameStarted)))
+				continue;
+			if(!child->gameStarted)
+				atomic_add(&job->ended, 1);
+			else
+			{
+				long slot = atomic_add(&job->followingCount, 1) - 1;
+
+				if(last)
+					continue;
+				if(slot < (1l << BOARD_BITS))
+					job->following[slot] = b;
+				else
+					job->full = 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static void run(ThreadProc worker, PerftContext **contexts, int threads)
+{
+	int n;
+
+	for(n = 1; n < threads; n++)
+		if(!thread_create(&contexts[n]->thread, worker, contexts[n]))
+			break;
+	worker(contexts[0]); // the calling thread counts too
+	for(int t = 1; t < n; t++)
+		thread_join(contexts[t]->thread);
+}
+
+// level by level: each depth's distinct boards are expanded into the next
+static void perft_levels(PerftJob *job, const GameState *root, PerftContext **contexts, int threads, PerftResult *result)
+{
+	job->current = (PerftBoard*)malloc(sizeof(PerftBoard) << BOARD_BITS);
+	job->following = (PerftBoard*)malloc(sizeof(PerftBoard) << BOARD_BITS);
+	job->set = (volatile long long*)malloc(sizeof(long long) << SET_BITS);
+	if(!job->current || !job->following || !job->set)
+		result->overflow = true;
+	else
+	{
+		pack(root, &job->current[0]);
+		job->currentCount = 1;
+	}
+
+	for(job->level = 0; job->level < job->depth && !result->overflow && job->currentCount > 0; job->level++)
+	{
+		PerftBoard *swap;
+
+		memset((void*)job->set, 0, sizeof(long long) << SET_BITS);
+		job->next = 0;
+		job->followingCount = 0;
+		job->ended = 0;
+		run(levels_worker, contexts, threads);
+		if(job->full)
+		{
+			result->overflow = true;
+			break;
+		}
+		result->counts[job->level + 1] = job->followingCount + job->ended;
+		swap = job->current;
+		job->current = job->following;
+		job->following = swap;
+		job->currentCount = job->followingCount;
+	}
+
+	free(job->current);
+	free(job->following);
+	free((void*)job->set);
+}
+
+void perft(const GameState *g, const int *sequence, int sequenceCount, int depth, bool dedup, int threads, PerftResult *result)
+{
+	PerftContext *contexts[PERFT_MAXTHREADS];
+	PerftJob *job;
+	GameState root = *g;
+	double startTime = time_usec();
+	int t;
+
+	memset(result, 0, sizeof(PerftResult));
+	result->counts[0] = 1;
+	if(depth > PERFT_MAXDEPTH)
+		depth = PERFT_MAXDEPTH;
+	for(t = 0; t < sequenceCount; t++)
+		if(sequence[t] < 0 || sequence[t] > 6)
+			sequenceCount = 0; // unknown piece, nothing to count
+	if(depth < 1 || sequenceCount < 1)
+		return;
+
+	job = (PerftJob*)calloc(1, sizeof(PerftJob));
+	if(!job)
+		return;
+	job->depth = depth;
+	for(t = 0; t <= depth; t++)
+		job->sequence[t] = sequence[t % sequenceCount];
+
+	root.gameStarted = true;
+	spawn(&root, job->sequence[0], job->sequence[1]);
+
+	if(threads <= 0)
+		threads = cpu_count();
+	if(threads > PERFT_MAXTHREADS)
+		threads = PERFT_MAXTHREADS;
+	for(t = 0; t < threads; t++)
+	{
+		contexts[t] = (PerftContext*)calloc(1, sizeof(PerftContext));
+		if(!contexts[t])
+			break;
+		contexts[t]->job = job;
+	}
+	threads = t;
+
+	if(threads > 0 && dedup)
+		perft_levels(job, &root, contexts, threads, result);
+	else if(threads > 0)
+	{
+		job->rootCount = expand(&root, job->roots, &result->overflow);
+		result->counts[1] = job->rootCount;
+		result->placements = job->rootCount;
+		run(paths_worker, contexts, threads);
+	}
+
+	for(t = 0; t < threads; t++)
+	{
+		if(!dedup)
+			for(int d = 2; d <= depth; d++)
+				result->counts[d] += contexts[t]->counts[d];
+		result->placements += contexts[t]->placements;
+		result->overflow = result->overflow || contexts[t]->overflow;
+		free(contexts[t]);
+	}
+	free(job);
+
+	result->seconds = (time_usec() - startTime) / 1e6;
+}
+
+int perft_sequence(const char *letters, int *sequence, int max)
+{
+	int count = 0;
+
+	for(; *letters && count < max; letters++)
+	{
+		const char *found = strchr(pieceLetters, *letters >= 'a' && *letters <= 'z' ? *letters - 'a' + 'A' : *letters);
+
+		if(!found || !*found)
+			return -1;
+		sequence[count++] = (int)(found - pieceLetters);
+	}
+	return count;
+}
+
+int perft_main(const char *args)
+{
+	int sequence[PERFT_MAXDEPTH + 1];
+	char letters[64] = "IOTZSLJ";
+	int depth = 0, count;
+	bool dedup = strstr(args, "dedup") != NULL;
+	PerftResult result;
+	GameState g;
+
+	if(sscanf(args, "%d %63s", &depth, letters) < 1 || depth < 1 || depth > PERFT_MAXDEPTH)
+	{
+		printf("usage: perft depth(1-%d) [pieces, e.g. IOTZSLJ] [dedup]\n", PERFT_MAXDEPTH);
+		return 1;
+	}
+	if(!strcmp(letters, "dedup"))
+		strcpy(letters, "IOTZSLJ");
+	count = perft_sequence(letters, sequence, PERFT_MAXDEPTH + 1);
+	if(count < 1)
+	{
+		printf("unknown pieces %s, use the letters %s\n", letters, pieceLetters);
+		return 1;
+	}
+
+	reset_game(&g, 1);
+#ifdef TETRIS_PROFILE
+	profile_start();
+#endif
+	perft(&g, sequence, count, depth, dedup, 0, &result);
+
+	printf("perft %s%s, %d threads\n", letters, dedup ? " dedup" : "", cpu_count());
+	for(int d = 1; d <= depth; d++)
+		printf("depth %2d %14lld\n", d, result.counts[d]);
+	if(result.overflow)
+		printf("out of room for more boards, the counts are incomplete\n");
+	printf("%lld placements in %.3f s, %.0f placements/s\n", result.placements, result.seconds,
+		result.placements / (result.seconds > 0 ? result.seconds : 1));
+#ifdef TETRIS_PROFILE
+	{
+		static char text[2048];
+
+		profile_stop();
+		profile_report(text, sizeof(text));
+		printf("%s", text);
+	}
+#endif
+	return 0;
+}
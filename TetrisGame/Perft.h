@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Game.h"
+
+// perft, after the chess engine tool: counts the boards a fixed piece
+// sequence can reach after 1..depth placements, found only through the
+// engine's own rotate_block, move_block and check_collision, so the counts
+// check any rework of them and the run time gives placements per second for
+// the whole rules engine.
+//
+// A placement is a distinct board one piece can lock into after flood filling
+// left, right, down and rotate from the spawn position. A placement that
+// locks at the top ends the game; it is counted but not followed. Without
+// dedup the counts are paths (a board reached by two orders counts twice);
+// with dedup each depth counts distinct boards by a 64 bit hash of the cells
+// and only those are followed.
+
+#define PERFT_MAXDEPTH 10
+
+struct PerftResult
+{
+	long long counts[PERFT_MAXDEPTH + 1]; // counts[d] boards after d placements, counts[0] is 1
+	long long placements; // placements generated, duplicates included
+	double seconds;
+	bool overflow; // counts are incomplete: dedup ran out of room (counts past the last full depth are 0) or a piece had more distinct placements than one expansion holds
+};
+
+// g supplies the map only, sequence[0] spawns first. Short sequences repeat.
+// threads 0 uses every core
+void perft(const GameState *g, const int *sequence, int sequenceCount, int depth, bool dedup, int threads, PerftResult *result);
+int perft_sequence(const char *letters, int *sequence, int max); //parses piece letters IOTZSLJ into types 0..6, count or -1
+int perft_main(const char *args); //"depth [letters] [dedup]" on an empty board, prints to stdout
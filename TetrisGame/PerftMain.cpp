@@ -0,0 +1,20 @@
+// move generator perft without the game window, e.g. on a Linux box:
+//   g++ -O2 PerftMain.cpp Perft.cpp Game.cpp -lpthread -o perft
+//   ./perft 4 IOTZSLJ dedup
+// add -DTETRIS_PROFILE Profiler.cpp for per operation time and hardware counters
+// the Windows build does the same with "TetrisGame.exe -perft 4 IOTZSLJ dedup"
+#include "Perft.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+	char args[256] = "";
+
+	for(int i = 1; i < argc; i++)
+	{
+		strncat(args, argv[i], sizeof(args) - strlen(args) - 2);
+		strcat(args, " ");
+	}
+	return perft_main(args);
+}
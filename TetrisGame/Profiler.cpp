@@ -0,0 +1,346 @@
+#include "Profiler.h"
+#include "Threads.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define OVERHEAD_CALLS 10000 // empty scopes timed by profile_start
+#define MAXDEPTH 16 // nested scopes tracked per thread, deeper ones are not corrected
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+static const char *opNames[PROFILE_OPS] = { "collision", "rotation", "lock", "line clear", "spawn", "instances" };
+static const char *counterNames[PROFILE_COUNTERS] = { "cycles", "instructions", "L1 misses", "LLC misses", "branch misses" };
+
+#define COUNTED (PROFILE_COUNTERS + 2) // totals column of the calls the counters ran for
+
+static volatile long running;
+static volatile long multiplexed; // a scope's counters ran for less than all of it and were scaled
+static volatile long long totals[PROFILE_OPS + 1][PROFILE_COUNTERS + 3]; // calls, ticks, the counters, then counted calls, the last row for calibration
+static bool available[PROFILE_COUNTERS]; // counters the profile_start thread could open
+static double nsecPerTick = 1.0;
+static double overhead[PROFILE_COUNTERS + 1]; // ticks, then the counters, of an empty scope
+static double nestedCost[PROFILE_COUNTERS + 1]; // what an empty scope adds to the one around it
+
+// open scopes of this thread, each counting the scopes that ran inside it so
+// their cost comes off its own time and counters
+static THREAD_LOCAL int depth;
+static THREAD_LOCAL long long descendants[MAXDEPTH];
+
+static unsigned long long read_ticks(void)
+{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (unsigned long long)(time_usec() * 1000.0); // already nanoseconds
+#endif
+}
+
+#ifdef __linux__
+// a thread's counters as one group so a single read gets them all
+struct ProfileThread
+{
+	int leader; // first counter that opened, -1 if none did
+	int fds[PROFILE_COUNTERS];
+	int slots[PROFILE_COUNTERS]; // place of each counter in a group read, -1 if it did not open
+	bool opened;
+
+	ProfileThread() : leader(-1), opened(false) {}
+	~ProfileThread()
+	{
+		for(int c = 0; opened && c < PROFILE_COUNTERS; c++)
+			if(fds[c] >= 0)
+				close(fds[c]);
+	}
+};
+
+static thread_local ProfileThread threadCounters;
+
+static const struct { unsigned int type; unsigned long long config; } events[PROFILE_COUNTERS] =
+{
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static void open_counters(ProfileThread *t)
+{
+	int n = 0;
+
+	t->opened = true;
+	for(int c = 0; c < PROFILE_COUNTERS; c++)
+	{
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[c].type;
+		attr.config = events[c].config;
+		attr.disabled = t->leader < 0; // the group starts when the leader is enabled
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		t->slots[c] = -1;
+		t->fds[c] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, t->leader, 0);
+		if(t->fds[c] < 0)
+			continue; // not allowed here, or no such counter on this CPU
+		if(t->leader < 0)
+			t->leader = t->fds[c];
+		t->slots[c] = n++;
+	}
+	if(t->leader >= 0)
+		ioctl(t->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+#endif
+
+static void read_counters(ProfileSample *s)
+{
+	memset(s->counters, 0, sizeof(s->counters));
+	s->enabled = s->running = 0;
+#ifdef __linux__
+	{
+		ProfileThread *t = &threadCounters;
+		unsigned long long values[3 + PROFILE_COUNTERS]; // count, time enabled, time running, then the values
+
+		if(!t->opened)
+			open_counters(t);
+		if(t->leader < 0 || read(t->leader, values, sizeof(values)) <= 0)
+			return;
+		s->enabled = values[1];
+		s->running = values[2];
+		for(int c = 0; c < PROFILE_COUNTERS; c++)
+			if(t->slots[c] >= 0)
+				s->counters[c] = values[3 + t->slots[c]];
+	}
+#endif
+}
+
+static void sample(ProfileSample *s)
+{
+	read_counters(s);
+	s->ticks = read_ticks();
+}
+
+// ticks and counters since s, in the reverse order sample took them. Counts
+// are scaled up when the group was multiplexed off the PMU for part of the
+// time; false, with the counters 0, when it never ran
+static bool measure(const ProfileSample *s, unsigned long long *delta)
+{
+	ProfileSample now;
+	unsigned long long enabled, ran;
+
+	now.ticks = read_ticks();
+	read_counters(&now);
+	delta[0] = now.ticks - s->ticks;
+	enabled = now.enabled - s->enabled;
+	ran = now.running - s->running;
+	if(ran < enabled && ran > 0)
+		atomic_release(&multiplexed, 1);
+	for(int c = 0; c < PROFILE_COUNTERS; c++)
+	{
+		unsigned long long count = now.counters[c] - s->counters[c];
+
+		delta[1 + c] = ran == 0 ? 0 : ran >= enabled ? count : (unsigned long long)((double)count * enabled / ran);
+	}
+	return ran > 0;
+}
+
+bool profile_start(void)
+{
+	static bool calibrated = false;
+	double sum[PROFILE_COUNTERS + 1] = { 0 }, nestedSum[PROFILE_COUNTERS + 1] = { 0 };
+	unsigned long long delta[PROFILE_COUNTERS + 1];
+	ProfileSample s, inner;
+	int counted = 0, nestedCounted = 0;
+	bool any = false;
+
+	atomic_release(&running, 0);
+	atomic_release(&multiplexed, 0);
+	memset((void*)totals, 0, sizeof(totals));
+
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	//time stamp counter ticks against the wall clock, once
+	if(!calibrated)
+	{
+		double usec = time_usec();
+		unsigned long long ticks = read_ticks();
+
+		sleep_msec(20);
+		nsecPerTick = (time_usec() - usec) * 1000.0 / (double)(read_ticks() - ticks);
+		calibrated = true;
+	}
+#endif
+
+	//what an empty scope costs, taken off every average, and what one costs the
+	//scope around it, taken off that scope for each one nested in it
+	memset(nestedCost, 0, sizeof(nestedCost));
+	atomic_release(&running, 1);
+	for(int i = 0; i < OVERHEAD_CALLS; i++)
+	{
+		sample(&s);
+		counted += measure(&s, delta);
+		for(int k = 0; k <= PROFILE_COUNTERS; k++)
+			sum[k] += (double)delta[k];
+
+		sample(&s);
+		profile_begin(&inner);
+		profile_end(PROFILE_OPS, &inner);
+		nestedCounted += measure(&s, delta);
+		for(int k = 0; k <= PROFILE_COUNTERS; k++)
+			nestedSum[k] += (double)delta[k];
+	}
+	for(int k = 0; k <= PROFILE_COUNTERS; k++)
+	{
+		//the counters only over the samples they ran for
+		int n = k == 0 ? OVERHEAD_CALLS : counted, nested = k == 0 ? OVERHEAD_CALLS : nestedCounted;
+
+		overhead[k] = n ? sum[k] / n : 0.0;
+		nestedCost[k] = nested ? nestedSum[k] / nested - overhead[k] : 0.0;
+		if(nestedCost[k] < 0.0)
+			nestedCost[k] = 0.0;
+	}
+
+	for(int c = 0; c < PROFILE_COUNTERS; c++)
+	{
+#ifdef __linux__
+		available[c] = threadCounters.slots[c] >= 0;
+#else
+		available[c] = false;
+#endif
+		any = any || available[c];
+	}
+	return any;
+}
+
+void profile_stop(void)
+{
+	atomic_release(&running, 0);
+}
+
+bool profile_running(void)
+{
+	return atomic_acquire(&running) != 0;
+}
+
+void profile_begin(ProfileSample *s)
+{
+	if(!atomic_acquire(&running))
+	{
+		s->ticks = 0;
+		return;
+	}
+	if(depth < MAXDEPTH)
+		descendants[depth] = 0;
+	depth++;
+	sample(s);
+}
+
+// op PROFILE_OPS is profile_start's calibration scope
+void profile_end(int op, const ProfileSample *s)
+{
+	unsigned long long delta[PROFILE_COUNTERS + 1];
+	long long nested = 0;
+	bool counted;
+
+	if(s->ticks == 0)
+		return;
+	counted = measure(s, delta);
+
+	//the scope is closed even for a bad op so the nesting stays in step
+	depth--;
+	if(depth < MAXDEPTH)
+		nested = descendants[depth];
+	if(depth > 0 && depth <= MAXDEPTH)
+		descendants[depth - 1] += nested + 1;
+	if(op < 0 || op > PROFILE_OPS)
+		return;
+
+	atomic_add64(&totals[op][0], 1);
+	if(counted)
+		atomic_add64(&totals[op][COUNTED], 1);
+	for(int k = 0; k <= (counted ? PROFILE_COUNTERS : 0); k++)
+	{
+		double value = (double)delta[k] - nested * nestedCost[k];
+
+		atomic_add64(&totals[op][1 + k], value > 0.0 ? (long long)value : 0);
+	}
+}
+
+void profile_stats(int op, ProfileStats *stats)
+{
+	long long calls = atomic_load64(&totals[op][0]), counted = atomic_load64(&totals[op][COUNTED]);
+	double ticks;
+
+	memset(stats, 0, sizeof(ProfileStats));
+	stats->calls = calls;
+	stats->counted = counted;
+	for(int c = 0; c < PROFILE_COUNTERS; c++)
+	{
+		double value = counted ? (double)atomic_load64(&totals[op][2 + c]) / counted - overhead[1 + c] : 0.0;
+
+		stats->counters[c] = !available[c] || !counted ? -1.0 : value > 0.0 ? value : 0.0;
+	}
+	if(!calls)
+		return;
+	ticks = (double)atomic_load64(&totals[op][1]) / calls - overhead[0];
+	stats->nsec = (ticks > 0.0 ? ticks : 0.0) * nsecPerTick;
+}
+
+int profile_report(char *text, int size)
+{
+	char line[256];
+	int length = 0, n;
+	bool any = false;
+
+	if(size > 0)
+		text[0] = 0;
+	for(int c = 0; c < PROFILE_COUNTERS; c++)
+		any = any || available[c];
+	n = sprintf(line, !any ? "profile: per call averages, time only, no hardware counters\n" :
+		atomic_acquire(&multiplexed) ? "profile: per call averages, counters from perf_event_open scaled where they were multiplexed\n" :
+		"profile: per call averages, counters from perf_event_open\n");
+
+	for(int op = -1; op < PROFILE_OPS; op++)
+	{
+		ProfileStats stats;
+
+		if(op >= 0)
+		{
+			profile_stats(op, &stats);
+			if(!stats.calls)
+				continue;
+			n = sprintf(line, "  %-10s %10lld calls %9.1f ns", opNames[op], stats.calls, stats.nsec);
+			for(int c = 0; c < PROFILE_COUNTERS; c++)
+				if(stats.counters[c] >= 0.0)
+					n += sprintf(line + n, " %9.1f %s", stats.counters[c], counterNames[c]);
+			if(any && stats.counted < stats.calls)
+				n += sprintf(line + n, " (counters ran for %lld calls)", stats.counted);
+			line[n++] = '\n';
+			line[n] = 0;
+		}
+		if(length + n >= size)
+			break;
+		memcpy(text + length, line, n + 1);
+		length += n;
+	}
+	return length;
+}
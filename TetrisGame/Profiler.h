@@ -0,0 +1,69 @@
+#pragma once
+
+// opt-in per operation profiling. Build with TETRIS_PROFILE defined (and
+// Profiler.cpp linked) and every PROFILE_SCOPE in the engine and renderer
+// adds its call to its operation once profile_start has run; without the
+// define the scopes compile to nothing.
+//
+// Each call is timed with the time stamp counter. On Linux perf_event_open
+// also counts cycles, instructions, L1 data and last level cache misses and
+// branch mispredicts of the calling thread, user space only. Where counters
+// are not allowed (containers, perf_event_paranoid, Windows) only the time is
+// kept. When more counters are open than the PMU has, the kernel multiplexes
+// them; each call's counts are scaled by the time the group was enabled over
+// the time it ran, and calls during which it never ran are left out of the
+// counter averages. Scopes nest and count inclusively, so lock includes its line clear.
+// A scope costs a group read syscall at each end; profile_start measures an
+// empty scope and that cost is taken off every average, and measures what an
+// empty scope adds to the one around it, which each scope takes off once for
+// every scope that ran inside it on the same thread.
+
+enum ProfileOp
+{
+	PROFILE_COLLISION, // check_collision
+	PROFILE_ROTATION, // rotate_block and the kick rotation
+	PROFILE_LOCK, // lock_block, line clear included
+	PROFILE_LINECLEAR, // the full row search and remove_row in lock_block
+	PROFILE_SPAWN, // create_block and Rules::spawn
+	PROFILE_INSTANCES, // build_instances and a wall board's cubes
+	PROFILE_OPS
+};
+
+enum ProfileCounter { PROFILE_CYCLES, PROFILE_INSTRUCTIONS, PROFILE_L1MISSES, PROFILE_LLCMISSES, PROFILE_BRANCHMISSES, PROFILE_COUNTERS };
+
+struct ProfileSample
+{
+	unsigned long long ticks; // 0 when not running
+	unsigned long long counters[PROFILE_COUNTERS];
+	unsigned long long enabled, running; // nanoseconds the counter group was enabled and on the PMU, to scale multiplexed counts
+};
+
+struct ProfileStats
+{
+	long long calls;
+	double nsec; // per call averages with the scope's own cost taken off
+	double counters[PROFILE_COUNTERS]; // -1 where the counter is unavailable or never ran during a call
+	long long counted; // calls the counters ran for, the counter averages are over these
+};
+
+bool profile_start(void); //clears the totals and starts counting, false if only time is kept
+void profile_stop(void);
+bool profile_running(void);
+void profile_begin(ProfileSample *s);
+void profile_end(int op, const ProfileSample *s);
+void profile_stats(int op, ProfileStats *stats);
+int profile_report(char *text, int size); //a line of per call averages for each operation that ran, returns the length
+
+#ifdef TETRIS_PROFILE
+struct ProfileScope
+{
+	int op;
+	ProfileSample sample;
+
+	ProfileScope(int o) : op(o) { profile_begin(&sample); }
+	~ProfileScope() { profile_end(op, &sample); }
+};
+#define PROFILE_SCOPE(op) ProfileScope profileScope(op)
+#else
+#define PROFILE_SCOPE(op)
+#endif
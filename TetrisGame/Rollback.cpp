@@ -0,0 +1,292 @@
+#include "Rollback.h"
+#include "Threads.h"
+#include <limits.h>
+#include <string.h>
+
+static void step_match(MatchState *m, int input0, int input1)
+{
+	step_game(&m->players[0], input0);
+	step_game(&m->players[1], input1);
+}
+
+unsigned int match_hash(const MatchState *m)
+{
+	return hash_game(&m->players[0]) * 31 + hash_game(&m->players[1]);
+}
+
+void rollback_start(RollbackSession *s, int localPlayer, unsigned int seed)
+{
+	memset(s, 0, sizeof(RollbackSession));
+	init_game(&s->current.players[0], seed);
+	init_game(&s->current.players[1], seed);
+	for(int i = 0; i < ROLLBACK_INPUTS; i++)
+		s->remoteTicks[i] = -1;
+	s->localPlayer = localPlayer;
+	s->rollbackTo = INT_MAX;
+	s->peerHashTick = -1;
+	for(int i = 0; i < ROLLBACK_INPUTS; i++)
+		s->confirmedHashTicks[i] = -1;
+}
+
+// real input when we have it, otherwise repeat the last one received
+static int remote_input(const RollbackSession *s, int tick)
+{
+	int slot = tick % ROLLBACK_INPUTS;
+
+	if(s->remoteTicks[slot] == tick)
+		return s->remoteInputs[slot];
+	return s->lastRemoteInput;
+}
+
+// saves the snapshot for s->tick and simulates it
+static void simulate_tick(RollbackSession *s)
+{
+	int slot = s->tick % ROLLBACK_FRAMES;
+	int local = s->localInputs[s->tick % ROLLBACK_INPUTS];
+	int remote = remote_input(s, s->tick);
+
+	s->snapshots[slot] = s->current;
+	s->hashes[slot] = match_hash(&s->current);
+	s->usedRemote[slot] = (unsigned char)remote;
+
+	if(s->localPlayer == 0)
+		step_match(&s->current, local, remote);
+	else
+		step_match(&s->current, remote, local);
+	s->tick++;
+}
+
+bool rollback_advance(RollbackSession *s, int localInput)
+{
+	//rewind to the first mispredicted tick and replay up to the present
+	if(s->rollbackTo < s->tick)
+	{
+		int present = s->tick;
+
+		s->tick = s->rollbackTo;
+		s->current = s->snapshots[s->tick % ROLLBACK_FRAMES];
+		while(s->tick < present)
+			simulate_tick(s);
+		s->rollbacks++;
+		s->resimulatedTicks += present - s->rollbackTo;
+	}
+	s->rollbackTo = INT_MAX;
+
+	//snapshots before the confirmed tick are final now, keep their hashes for the peer to check
+	while(s->hashedTick <= s->confirmedTick && s->hashedTick < s->tick)
+	{
+		s->confirmedHashes[s->hashedTick % ROLLBACK_INPUTS] = s->hashes[s->hashedTick % ROLLBACK_FRAMES];
+		s->confirmedHashTicks[s->hashedTick % ROLLBACK_INPUTS] = s->hashedTick;
+		s->hashedTick++;
+	}
+
+	if(s->peerHashTick >= 0 && s->peerHashTick < s->hashedTick)
+	{
+		int slot = s->peerHashTick % ROLLBACK_INPUTS;
+		if(s->confirmedHashTicks[slot] == s->peerHashTick && s->confirmedHashes[slot] != s->peerHash)
+			s->desynced = true;
+		s->peerHashTick = -1;
+	}
+
+	//never run further ahead than the snapshots can rewind
+	if(s->tick - s->confirmedTick >= ROLLBACK_FRAMES - 1)
+		return false;
+	//nor overwrite an input the peer may still need resent
+	if(s->tick - s->peerAck >= ROLLBACK_INPUTS)
+		return false;
+
+	s->localInputs[s->tick % ROLLBACK_INPUTS] = (unsigned char)localInput;
+	simulate_tick(s);
+	return true;
+}
+
+void rollback_remote_input(RollbackSession *s, int tick, int input)
+{
+	int slot = tick % ROLLBACK_INPUTS;
+
+	//already have it, or too far ahead to store
+	if(tick < s->confirmedTick || s->remoteTicks[slot] == tick || tick >= s->confirmedTick + ROLLBACK_INPUTS)
+		return;
+
+	s->remoteInputs[slot] = (unsigned char)input;
+	s->remoteTicks[slot] = tick;
+
+	if(tick < s->tick && s->usedRemote[tick % ROLLBACK_FRAMES] != input && tick < s->rollbackTo)
+		s->rollbackTo = tick;
+
+	while(s->remoteTicks[s->confirmedTick % ROLLBACK_INPUTS] == s->confirmedTick)
+	{
+		s->lastRemoteInput = s->remoteInputs[s->confirmedTick % ROLLBACK_INPUTS];
+		s->confirmedTick++;
+	}
+}
+
+void rollback_peer_hash(RollbackSession *s, int tick, unsigned int hash)
+{
+	if(tick > s->peerHashTick)
+	{
+		s->peerHashTick = tick;
+		s->peerHash = hash;
+	}
+}
+
+// --- transport ---
+
+// packet: first tick, input count, inputs, ack, hash tick, hash. Little endian.
+// The inputs start at the oldest one the peer has not acknowledged, so a burst
+// of lost packets is made up for by the next one that gets through.
+static int put_int(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+	return 4;
+}
+
+static unsigned int get_int(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+bool udp_open(UdpTransport *t, int localPort, const char *peerAddress, int peerPort)
+{
+	struct sockaddr_in local;
+
+	memset(t, 0, sizeof(UdpTransport));
+	t->random = 12345;
+	if(!socket_startup())
+		return false;
+
+	t->sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if(t->sock == INVALID_SOCKET)
+		return false;
+
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons((unsigned short)localPort);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if(bind(t->sock, (struct sockaddr*)&local, sizeof(local)) != 0)
+	{
+		socket_close(t->sock);
+		return false;
+	}
+	socket_nonblocking(t->sock);
+
+	t->peer.sin_family = AF_INET;
+	t->peer.sin_port = htons((unsigned short)peerPort);
+	t->peer.sin_addr.s_addr = inet_addr(peerAddress);
+	return true;
+}
+
+void udp_simulate(UdpTransport *t, int latencyMs, int jitterMs, int lossPercent)
+{
+	t->latencyMs = latencyMs;
+	t->jitterMs = jitterMs;
+	t->lossPercent = lossPercent;
+}
+
+void udp_outage(UdpTransport *t, int msec)
+{
+	t->outageUntil = time_usec() + msec * 1000.0;
+}
+
+void udp_close(UdpTransport *t)
+{
+	socket_close(t->sock);
+}
+
+static int transport_random(UdpTransport *t)
+{
+	t->random = t->random * 214013 + 2531011;
+	return (t->random >> 16) & 0x7fff;
+}
+
+// sends delayed packets whose time has come
+static void flush_delayed(UdpTransport *t)
+{
+	double now = time_usec();
+	int i = 0;
+
+	while(i < t->delayedCount)
+	{
+		if(t->delayed[i].due <= now)
+		{
+			sendto(t->sock, (const char*)t->delayed[i].data, t->delayed[i].len, 0, (struct sockaddr*)&t->peer, sizeof(t->peer));
+			t->delayed[i] = t->delayed[--t->delayedCount];
+		}
+		else
+			i++;
+	}
+}
+
+static void udp_send(UdpTransport *t, const unsigned char *data, int len)
+{
+	if(t->lossPercent > 0 && transport_random(t) % 100 < t->lossPercent)
+		return;
+	if(t->outageUntil > 0.0 && time_usec() < t->outageUntil)
+		return;
+
+	if(t->latencyMs > 0 || t->jitterMs > 0)
+	{
+		if(t->delayedCount < UDP_DELAYED)
+		{
+			DelayedPacket *p = &t->delayed[t->delayedCount++];
+			int delay = t->latencyMs + (t->jitterMs > 0 ? transport_random(t) % (t->jitterMs + 1) : 0);
+
+			p->due = time_usec() + delay * 1000.0;
+			p->len = len;
+			memcpy(p->data, data, len);
+		}
+		return;
+	}
+
+	sendto(t->sock, (const char*)data, len, 0, (struct sockaddr*)&t->peer, sizeof(t->peer));
+}
+
+void rollback_send(RollbackSession *s, UdpTransport *t)
+{
+	unsigned char packet[UDP_PACKET];
+	int first = s->peerAck, count = s->tick - first, n = 0, hashTick;
+
+	if(count > ROLLBACK_PACKET_INPUTS)
+		count = ROLLBACK_PACKET_INPUTS;
+
+	n += put_int(packet + n, first);
+	packet[n++] = (unsigned char)count;
+	for(int i = 0; i < count; i++)
+		packet[n++] = s->localInputs[(first + i) % ROLLBACK_INPUTS];
+	n += put_int(packet + n, s->confirmedTick);
+
+	//newest hash no late input can change
+	hashTick = s->hashedTick - 1;
+	n += put_int(packet + n, hashTick);
+	n += put_int(packet + n, hashTick >= 0 ? s->confirmedHashes[hashTick % ROLLBACK_INPUTS] : 0);
+
+	udp_send(t, packet, n);
+	flush_delayed(t);
+}
+
+void rollback_receive(RollbackSession *s, UdpTransport *t)
+{
+	unsigned char packet[UDP_PACKET];
+	int len;
+
+	flush_delayed(t);
+	while((len = recvfrom(t->sock, (char*)packet, sizeof(packet), 0, NULL, NULL)) > 5)
+	{
+		int first = (int)get_int(packet), count = packet[4], ack;
+
+		if(count > ROLLBACK_PACKET_INPUTS || len < 5 + count + 12)
+			continue;
+		for(int i = 0; i < count; i++)
+			rollback_remote_input(s, first + i, packet[5 + i]);
+
+		//packets can arrive out of order, an older ack never moves ours back
+		ack = (int)get_int(packet + 5 + count);
+		if(ack > s->peerAck && ack <= s->tick)
+			s->peerAck = ack;
+
+		int hashTick = (int)get_int(packet + 9 + count);
+		if(hashTick >= 0)
+			rollback_peer_hash(s, hashTick, get_int(packet + 13 + count));
+	}
+}
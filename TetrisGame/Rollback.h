@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Game.h"
+#include "Sockets.h"
+
+// rollback netcode for head to head play. Every tick is simulated right away
+// with a predicted remote input (the last one received). When the real input
+// arrives late and differs, the match is restored from the snapshot of that
+// tick and resimulated up to the present within the same frame.
+
+#define ROLLBACK_FRAMES 16 // snapshot ring, the furthest back we can rewind
+#define ROLLBACK_INPUTS 64 // remote input ring, must cover ticks sent ahead of us
+#define ROLLBACK_PACKET_INPUTS 32 // most inputs one packet carries, oldest unacknowledged first
+
+struct MatchState { GameState players[2]; };
+
+struct RollbackSession
+{
+	MatchState current;
+	MatchState snapshots[ROLLBACK_FRAMES]; // state at the start of tick t is in slot t % ROLLBACK_FRAMES
+	unsigned int hashes[ROLLBACK_FRAMES]; // hash of each snapshot
+	unsigned char localInputs[ROLLBACK_INPUTS]; // local input of tick t, kept until the peer acknowledges it
+	unsigned char usedRemote[ROLLBACK_FRAMES]; // remote input (real or predicted) tick t was simulated with
+	unsigned char remoteInputs[ROLLBACK_INPUTS];
+	int remoteTicks[ROLLBACK_INPUTS]; // tick each remoteInputs entry belongs to, -1 if empty
+	int localPlayer;
+	int tick; // next tick to simulate
+	int confirmedTick; // every remote input before this tick has arrived
+	int peerAck; // the peer's confirmedTick, every local input before it has arrived there
+	int lastRemoteInput; // prediction for ticks without a real input
+	int rollbackTo; // earliest tick simulated with a wrong prediction, INT_MAX if none
+	unsigned int confirmedHashes[ROLLBACK_INPUTS]; // hashes that no late input can change any more
+	int confirmedHashTicks[ROLLBACK_INPUTS];
+	int hashedTick; // next tick to go into confirmedHashes
+	int peerHashTick; // last hash reported by the peer, checked against ours
+	unsigned int peerHash;
+	bool desynced;
+	int rollbacks; // number of rewinds
+	int resimulatedTicks;
+};
+
+void rollback_start(RollbackSession *s, int localPlayer, unsigned int seed); //both players start from the same seed
+bool rollback_advance(RollbackSession *s, int localInput); //fixes any misprediction then simulates one tick, false when too far ahead of the peer or its ack
+void rollback_remote_input(RollbackSession *s, int tick, int input); //records the peer's input for a tick
+void rollback_peer_hash(RollbackSession *s, int tick, unsigned int hash); //compares the peer's state hash with ours
+unsigned int match_hash(const MatchState *m);
+
+// UDP transport with optional simulated latency, jitter and loss for testing over loopback
+#define UDP_DELAYED 256
+
+#define UDP_PACKET 64
+
+struct DelayedPacket { double due; int len; unsigned char data[UDP_PACKET]; };
+
+struct UdpTransport
+{
+	SOCKET sock;
+	struct sockaddr_in peer;
+	int latencyMs, jitterMs, lossPercent;
+	double outageUntil; // every packet sent before this time is lost
+	DelayedPacket delayed[UDP_DELAYED];
+	int delayedCount;
+	unsigned int random;
+};
+
+bool udp_open(UdpTransport *t, int localPort, const char *peerAddress, int peerPort);
+void udp_simulate(UdpTransport *t, int latencyMs, int jitterMs, int lossPercent); //applied to packets we send
+void udp_outage(UdpTransport *t, int msec); //loses every packet we send for the next msec
+void udp_close(UdpTransport *t);
+void rollback_send(RollbackSession *s, UdpTransport *t); //sends our inputs from the peer's last ack, our own ack and newest confirmed hash
+void rollback_receive(RollbackSession *s, UdpTransport *t); //applies every packet waiting on the socket
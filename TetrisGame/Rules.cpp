@@ -0,0 +1,36 @@
+#include "Rules.h"
+
+static const RuleVariant variants[] =
+{
+	{ "classic", "no kicks, random pieces, 1 sec gravity, locks on contact",
+		ClassicRules::init, ClassicRules::step },
+	{ "kicks", "classic with wall and floor kicks",
+		Rules<KickRotation, ClassicRandomizer, ClassicGravity, ImmediateLock>::init,
+		Rules<KickRotation, ClassicRandomizer, ClassicGravity, ImmediateLock>::step },
+	{ "bag", "classic with a 7 piece bag",
+		Rules<ClassicRotation, BagRandomizer, ClassicGravity, ImmediateLock>::init,
+		Rules<ClassicRotation, BagRandomizer, ClassicGravity, ImmediateLock>::step },
+	{ "levels", "classic with gravity speeding up every 10 lines",
+		Rules<ClassicRotation, ClassicRandomizer, LevelGravity, ImmediateLock>::init,
+		Rules<ClassicRotation, ClassicRandomizer, LevelGravity, ImmediateLock>::step },
+	{ "lockdelay", "classic with a half second lock delay",
+		Rules<ClassicRotation, ClassicRandomizer, ClassicGravity, DelayedLock<30, 15> >::init,
+		Rules<ClassicRotation, ClassicRandomizer, ClassicGravity, DelayedLock<30, 15> >::step },
+	{ "modern", "kicks, 7 piece bag, level gravity and lock delay",
+		Rules<KickRotation, BagRandomizer, LevelGravity, DelayedLock<30, 15> >::init,
+		Rules<KickRotation, BagRandomizer, LevelGravity, DelayedLock<30, 15> >::step },
+};
+
+const RuleVariant* find_rules(const char *name)
+{
+	for(int i = 0; i < (int)(sizeof(variants) / sizeof(variants[0])); i++)
+		if(strcmp(variants[i].name, name) == 0)
+			return &variants[i];
+	return NULL;
+}
+
+const RuleVariant* rule_variants(int *count)
+{
+	*count = sizeof(variants) / sizeof(variants[0]);
+	return variants;
+}
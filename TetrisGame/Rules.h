@@ -0,0 +1,254 @@
+#pragma once
+
+#include "Game.h"
+#include "Profiler.h"
+#include <string.h>
+
+// rule variants built from policy classes. Rules<...>::step is step_game with
+// each rule swapped for its policy; every policy call is a static inline
+// function, so a variant compiles to one flat step with nothing looked up at
+// run time. Rules<ClassicRotation, ClassicRandomizer, ClassicGravity,
+// ImmediateLock> plays exactly like init_game/step_game.
+
+// true if shape fits the map with its top left corner at x,y
+inline bool shape_fits(const GameState *g, const unsigned char shape[4][4], int x, int y)
+{
+	for(int i = 0; i < 4; i++)
+		for(int j = 0; j < 4; j++)
+			if(shape[i][j] != TILENODRAW)
+			{
+				if(x + i < 0 || x + i > MAPWIDTH - 1 || y + j < 0 || y + j > MAPHEIGHT - 1)
+					return false;
+				if(g->map[x + i][y + j] != TILEBLACK)
+					return false;
+			}
+	return true;
+}
+
+// rotation: int rotate(g) turns the current piece, 0 if it stayed as it was
+
+struct ClassicRotation // rotate in place or not at all
+{
+	static int rotate(GameState *g) { return rotate_block(g); }
+};
+
+// the SRS kick tables are offsets for pieces turning about the SRS rotation
+// centres; these turn about the middle of their 4x4 box (Piece.rotation only
+// counts the turns), so per state SRS offsets would not give SRS behaviour.
+// One kick list is tried in order for every turn instead: in place, a step
+// off either wall, up a row, then two steps for the tower
+struct KickRotation
+{
+	static int rotate(GameState *g)
+	{
+		PROFILE_SCOPE(PROFILE_ROTATION);
+		static const int kicks[6][2] = { { 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, -1 }, { -2, 0 }, { 2, 0 } };
+		unsigned char temp[4][4];
+
+		for(int i = 0; i < 4; i++)
+			for(int j = 0; j < 4; j++)
+				temp[3 - j][i] = g->piece.size[i][j];
+
+		for(int k = 0; k < 6; k++)
+			if(shape_fits(g, temp, g->piece.x + kicks[k][0], g->piece.y + kicks[k][1]))
+			{
+				memcpy(g->piece.size, temp, sizeof(temp));
+				g->piece.x += kicks[k][0];
+				g->piece.y += kicks[k][1];
+				g->piece.rotation = (g->piece.rotation + 1) & 3;
+				return 1;
+			}
+		return 0;
+	}
+};
+
+// randomizer: int next(g) is the type 0..6 of the next piece
+
+struct ClassicRandomizer // every piece independent, as create_block
+{
+	static int next(GameState *g) { return next_random(g) % 7; }
+};
+
+struct BagRandomizer // deals all 7 types in random order before repeating any
+{
+	static int next(GameState *g)
+	{
+		int left = 0, pick, type;
+
+		if(g->bag == 0x7f)
+			g->bag = 0;
+		for(type = 0; type < 7; type++)
+			if(!(g->bag & (1 << type)))
+				left++;
+
+		pick = next_random(g) % left;
+		for(type = 0; ; type++)
+			if(!(g->bag & (1 << type)) && pick-- == 0)
+				break;
+
+		g->bag |= 1 << type;
+		return type;
+	}
+};
+
+// gravity: int ticks(g) between gravity steps
+
+struct ClassicGravity // once a second at any level
+{
+	static int ticks(const GameState *) { return GRAVITYTICKS; }
+};
+
+struct LevelGravity // one level per 10 lines, faster each level down to a row a tick
+{
+	static int ticks(const GameState *g)
+	{
+		static const int levels[13] = { 60, 48, 38, 30, 23, 17, 12, 8, 6, 4, 3, 2, 1 };
+		int level = g->lines / 10;
+		return levels[level < 12 ? level : 12];
+	}
+};
+
+// lock: blocked(g) runs when a fall is stopped by the stack, expired(g) once at
+// the end of every tick, either returning true locks the piece. moved(g) runs
+// after a successful shift or rotation, spawned(g) for every new piece
+
+struct ImmediateLock // locks on the first fall that collides, as move_block
+{
+	static bool blocked(GameState *) { return true; }
+	static bool expired(GameState *) { return false; }
+	static void moved(GameState *) { }
+	static void spawned(GameState *) { }
+};
+
+// locks after Delay ticks resting on the stack, moving or rotating restarts the
+// wait up to Resets times per piece so it can't be stalled forever
+template <int Delay, int Resets>
+struct DelayedLock
+{
+	static bool blocked(GameState *) { return false; }
+	static bool expired(GameState *g)
+	{
+		if(!check_collision(g, 0, 1))
+		{
+			g->lockTicks = 0;
+			return false;
+		}
+		return ++g->lockTicks >= Delay;
+	}
+	static void moved(GameState *g)
+	{
+		if(g->lockTicks > 0 && g->lockResets < Resets)
+		{
+			g->lockTicks = 0;
+			g->lockResets++;
+		}
+	}
+	static void spawned(GameState *g)
+	{
+		g->lockTicks = 0;
+		g->lockResets = 0;
+	}
+};
+
+template <class Rotation, class Randomizer, class Gravity, class Lock>
+struct Rules
+{
+	static void init(GameState *g, unsigned int seed)
+	{
+		reset_game(g, seed);
+		spawn(g);
+	}
+
+	// create_block with the randomizer policy
+	static void spawn(GameState *g)
+	{
+		PROFILE_SCOPE(PROFILE_SPAWN);
+
+		if(g->gameStarted == false)
+		{
+			make_piece(&g->piece, Randomizer::next(g));
+			g->gameStarted = true;
+		}
+		else
+			g->piece = g->prePiece;
+
+		g->piece.x = MAPWIDTH/2 - 2;
+		g->piece.y = 0;
+		g->pieces++;
+		Lock::spawned(g);
+
+		make_piece(&g->prePiece, Randomizer::next(g));
+		g->prePiece.x = MAPWIDTH + 2;
+		g->prePiece.y = MAPHEIGHT - 4;
+	}
+
+	static void land(GameState *g)
+	{
+		if(g->piece.y < 1)
+			game_over(g);
+		else
+		{
+			lock_block(g);
+			spawn(g);
+		}
+	}
+
+	static void shift(GameState *g, int x)
+	{
+		if(!check_collision(g, x, 0))
+		{
+			g->piece.x += x;
+			Lock::moved(g);
+		}
+	}
+
+	static void fall(GameState *g)
+	{
+		if(!check_collision(g, 0, 1))
+			g->piece.y++;
+		else if(Lock::blocked(g))
+			land(g);
+	}
+
+	static void step(GameState *g, int input)
+	{
+		if(!g->gameStarted)
+			return;
+
+		g->tick++;
+		g->score++;
+
+		if(input & INPUT_ROTATE)
+			if(Rotation::rotate(g))
+				Lock::moved(g);
+		if(input & INPUT_LEFT)
+			shift(g, -1);
+		if(input & INPUT_RIGHT)
+			shift(g, 1);
+		if(input & INPUT_DOWN)
+			fall(g);
+
+		if(++g->gravityTicks >= Gravity::ticks(g))
+		{
+			g->gravityTicks = 0;
+			fall(g);
+		}
+
+		if(g->gameStarted && Lock::expired(g))
+			land(g);
+	}
+};
+
+typedef Rules<ClassicRotation, ClassicRandomizer, ClassicGravity, ImmediateLock> ClassicRules;
+
+// precompiled variants picked by name at run time
+struct RuleVariant
+{
+	const char *name;
+	const char *description;
+	void (*init)(GameState *g, unsigned int seed);
+	void (*step)(GameState *g, int input);
+};
+
+const RuleVariant* find_rules(const char *name); //NULL if no variant has that name
+const RuleVariant* rule_variants(int *count); //every variant, classic first
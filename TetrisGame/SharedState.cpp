@@ -0,0 +1,96 @@
+#include "SharedState.h"
+#include "Game.h"
+#include <string.h>
+
+#ifdef _WIN32
+static HANDLE mapping;
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char shmPath[128];
+#endif
+static SharedState *shared = NULL;
+
+bool shared_open(const char *name)
+{
+#ifdef _WIN32
+	char path[128];
+
+	_snprintf(path, sizeof(path), "Local\\%s", name ? name : SHARED_NAME);
+	path[sizeof(path) - 1] = 0;
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedState), path);
+	if(!mapping)
+		return false;
+	shared = (SharedState*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedState));
+	if(!shared)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+#else
+	int fd;
+	void *p;
+
+	snprintf(shmPath, sizeof(shmPath), "/%s", name ? name : SHARED_NAME);
+	fd = shm_open(shmPath, O_CREAT | O_RDWR, 0644);
+	if(fd < 0)
+		return false;
+	if(ftruncate(fd, sizeof(SharedState)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	p = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return false;
+	shared = (SharedState*)p;
+#endif
+	memset(shared, 0, sizeof(SharedState));
+	return true;
+}
+
+void shared_publish(const GameState *g)
+{
+	int x, y;
+
+	if(!shared)
+		return;
+
+	atomic_add(&shared->sequence, 1); // odd, and a full barrier so readers see it before any field changes
+
+	shared->magic = SHARED_MAGIC;
+	shared->version = SHARED_VERSION;
+	shared->tick = g->tick;
+	shared->publishUsec = (int64_t)time_usec();
+	for(y = 0; y < MAPHEIGHT; y++)
+		for(x = 0; x < MAPWIDTH; x++)
+			shared->map[y][x] = g->map[x][y];
+	memcpy(shared->piece, g->piece.size, sizeof(shared->piece));
+	memcpy(shared->preview, g->prePiece.size, sizeof(shared->preview));
+	shared->pieceX = g->piece.x;
+	shared->pieceY = g->piece.y;
+	shared->rotation = g->piece.rotation;
+	shared->score = g->score;
+	shared->lines = g->lines;
+	shared->pieces = g->pieces;
+	shared->danger = g->danger;
+	shared->gameStarted = g->gameStarted;
+
+	atomic_release(&shared->sequence, shared->sequence + 1); // even again, publishes the fields
+}
+
+void shared_close(void)
+{
+	if(!shared)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(shared);
+	CloseHandle(mapping);
+#else
+	munmap(shared, sizeof(SharedState));
+	shm_unlink(shmPath);
+#endif
+	shared = NULL;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Threads.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// live game state in a named shared memory region for overlays, coaching
+// tools and bots in other processes. The game writes under a seqlock: the
+// sequence is odd while an update is in progress, so a reader copies or reads
+// in place and retries if the sequence moved. Readers never take a lock or
+// make a system call per read, and the game never waits for them.
+//
+// Everything a reader needs is inline in this header, a tool only has to
+// include it (and Threads.h) to call shared_attach/shared_read.
+
+#define SHARED_NAME "TetrisGameState" // Local\TetrisGameState on Windows, /TetrisGameState with shm_open
+#define SHARED_MAGIC 0x54475331 // "TGS1"
+#define SHARED_VERSION 2
+#define SHARED_WIDTH 10 // MAPWIDTH
+#define SHARED_HEIGHT 20 // MAPHEIGHT
+
+// the region layout: exact width fields, each at an offset that is a multiple
+// of its size and padded to a multiple of 8, so 32 and 64 bit readers built
+// with any compiler see the same 288 bytes
+struct SharedState
+{
+	uint32_t magic; // SHARED_MAGIC once the game has published
+	uint32_t version;
+	volatile int32_t sequence; // odd while the game is writing, sequence / 2 counts publishes
+	uint32_t tick; // GameState tick, TICKRATE per second of play
+	int64_t publishUsec; // time_usec of the publish in whole microseconds, same clock in every process
+	uint8_t map[SHARED_HEIGHT][SHARED_WIDTH]; // TILE* colours, row 0 at the top
+	uint8_t piece[4][4]; // active piece as [x][y], TILENODRAW where empty
+	uint8_t preview[4][4];
+	int32_t pieceX, pieceY; // map position of piece[0][0]
+	int32_t rotation; // quarter turns since the piece spawned
+	int32_t score, lines, pieces;
+	uint8_t danger, gameStarted;
+	uint8_t padding[6];
+};
+
+static_assert(sizeof(SharedState) == 288, "SharedState layout changed, bump SHARED_VERSION");
+
+#ifdef _WIN32
+struct SharedReader { HANDLE mapping; const SharedState *state; };
+
+inline bool shared_attach(SharedReader *r, const char *name)
+{
+	char path[128];
+
+	_snprintf(path, sizeof(path), "Local\\%s", name ? name : SHARED_NAME);
+	path[sizeof(path) - 1] = 0;
+	r->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, path);
+	if(!r->mapping)
+		return false;
+	r->state = (const SharedState*)MapViewOfFile(r->mapping, FILE_MAP_READ, 0, 0, sizeof(SharedState));
+	if(!r->state)
+	{
+		CloseHandle(r->mapping);
+		return false;
+	}
+	return true;
+}
+
+inline void shared_detach(SharedReader *r)
+{
+	UnmapViewOfFile((void*)r->state);
+	CloseHandle(r->mapping);
+}
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+
+struct SharedReader { const SharedState *state; };
+
+inline bool shared_attach(SharedReader *r, const char *name)
+{
+	char path[128];
+	void *p;
+	int fd;
+
+	snprintf(path, sizeof(path), "/%s", name ? name : SHARED_NAME);
+	fd = shm_open(path, O_RDONLY, 0);
+	if(fd < 0)
+		return false;
+	p = mmap(NULL, sizeof(SharedState), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED)
+		return false;
+	r->state = (const SharedState*)p;
+	return true;
+}
+
+inline void shared_detach(SharedReader *r)
+{
+	munmap((void*)r->state, sizeof(SharedState));
+}
+#endif
+
+// in place reading: fields of r->state read between shared_begin and a
+// shared_retry that returns false form one consistent snapshot
+inline int32_t shared_begin(const SharedReader *r)
+{
+	return atomic_acquire((volatile int32_t*)&r->state->sequence);
+}
+
+inline bool shared_retry(const SharedReader *r, int32_t seq)
+{
+	memory_fence(); // the field reads complete before the sequence is checked again
+	return (seq & 1) || r->state->sequence != seq;
+}
+
+// copies a consistent snapshot, false if the game has not published yet or
+// stayed mid update (e.g. it died while writing) for every attempt
+inline bool shared_read(const SharedReader *r, SharedState *out)
+{
+	for(int attempt = 0; attempt < 10000; attempt++)
+	{
+		int32_t seq = shared_begin(r);
+
+		if(seq & 1)
+			continue;
+		memcpy(out, (const void*)r->state, sizeof(SharedState));
+		if(!shared_retry(r, seq))
+			return out->magic == SHARED_MAGIC && out->version == SHARED_VERSION;
+	}
+	return false;
+}
+
+// game side, in SharedState.cpp
+struct GameState;
+bool shared_open(const char *name); //creates the region, NULL for SHARED_NAME
+void shared_publish(const GameState *g); //never blocks, call once per tick or frame
+void shared_close(void);
@@ -0,0 +1,42 @@
+#pragma once
+
+// the few socket calls we need, same code on Winsock and BSD sockets
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment (lib, "ws2_32.lib")
+
+typedef int socklen_t;
+
+inline bool socket_startup(void) { WSADATA wsa; return WSAStartup(MAKEWORD(2, 2), &wsa) == 0; }
+inline void socket_close(SOCKET s) { closesocket(s); }
+inline void socket_nonblocking(SOCKET s) { u_long on = 1; ioctlsocket(s, FIONBIO, &on); }
+inline void socket_timeout(SOCKET s, int msec) // recv and send give up after msec
+{
+	DWORD t = (DWORD)msec;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&t, sizeof(t));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&t, sizeof(t));
+}
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+
+inline bool socket_startup(void) { return true; }
+inline void socket_close(SOCKET s) { close(s); }
+inline void socket_nonblocking(SOCKET s) { fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK); }
+inline void socket_timeout(SOCKET s, int msec) // recv and send give up after msec
+{
+	struct timeval t = { msec / 1000, (msec % 1000) * 1000 };
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t));
+	setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t));
+}
+#endif
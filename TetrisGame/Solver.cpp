@@ -0,0 +1,531 @@
+#include "Solver.h"
+#include "Threads.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WALLS 0xffffe007u // every bit outside the board columns, which sit at bits 3..12
+#define FULL 0xffffffffu
+#define MAXMOVES 128 // distinct lock positions of one piece
+#define MEMO_BITS 18 // 4 MB of remembered failures per thread
+#define SOLVER_MAXTHREADS 64
+
+typedef unsigned int Row;
+
+// board rows shifted left 3 with the walls set, the rows past the floor are solid
+struct Board { Row rows[MAPHEIGHT + 4]; };
+
+// one orientation as row masks of its 4x4 box, bit i is size[i][j]
+struct Shape { Row rows[4]; int top, bottom; };
+
+struct Move { int x, y, rotation; };
+
+struct MemoEntry { unsigned long long key; int lines; }; // key is the board key + 1, 0 when unused
+
+struct SolverJob
+{
+	int types[SOLVER_MAXPIECES];
+	int count; // pieces the solution may use
+	int targetLines; // 0 for a perfect clear
+	int height; // rows above the floor the search may fill
+	Board root;
+	Move topMoves[MAXMOVES]; // first piece placements, shared out to the threads
+	int topCount;
+	volatile long next; // next top level move to hand out
+	volatile long best; // lowest top level move that solved, topCount while none has
+	SolverPlacement bestPath[SOLVER_MAXPIECES];
+	int bestCount, bestLines;
+	Mutex lock;
+};
+
+struct SearchContext
+{
+	SolverJob *job;
+	Thread thread;
+	int branch; // top level move being searched
+	long long nodes;
+	MemoEntry *memo;
+	SolverPlacement path[SOLVER_MAXPIECES];
+	int count, lines; // of the solution in path
+};
+
+static Shape shapes[7][4];
+static int parityLimit[7]; // most one piece can shift the even/odd column balance of the empty cells
+
+static int popcount(unsigned int v)
+{
+	int n = 0;
+
+	for(; v; v &= v - 1)
+		n++;
+	return n;
+}
+
+// the orientations rotate_block steps through, from make_piece
+static void init_shapes(void)
+{
+	for(int t = 0; t < 7; t++)
+	{
+		Piece p;
+
+		make_piece(&p, t);
+		parityLimit[t] = 0;
+		for(int r = 0; r < 4; r++)
+		{
+			Shape *s = &shapes[t][r];
+			unsigned char temp[4][4];
+			int balance = 0;
+
+			s->top = 4;
+			s->bottom = -1;
+			for(int j = 0; j < 4; j++)
+			{
+				s->rows[j] = 0;
+				for(int i = 0; i < 4; i++)
+					if(p.size[i][j] != TILENODRAW)
+					{
+						s->rows[j] |= 1 << i;
+						balance += (i & 1) ? -1 : 1;
+						if(j < s->top)
+							s->top = j;
+						s->bottom = j;
+					}
+			}
+			if(abs(balance) > parityLimit[t])
+				parityLimit[t] = abs(balance);
+
+			for(int i = 0; i < 4; i++)
+				for(int j = 0; j < 4; j++)
+					temp[3 - j][i] = p.size[i][j];
+			memcpy(p.size, temp, sizeof(temp));
+		}
+	}
+}
+
+static inline bool fits(const Board *b, const Shape *s, int x, int y)
+{
+	for(int j = s->top; j <= s->bottom; j++)
+		if((s->rows[j] << (x + 3)) & b->rows[y + j])
+			return false;
+	return true;
+}
+
+// every distinct lock position of type at or below row limit, reachable with
+// the classic moves from start, or from anywhere above limit if start is NULL
+static int generate(const Board *b, int type, int limit, const Move *start, Move *out)
+{
+	unsigned int visited[4][MAPWIDTH + 6]; // bit y, indexed by x + 3
+	Move queue[4 * (MAPWIDTH + 6) * MAPHEIGHT];
+	unsigned long long locks[MAXMOVES];
+	int head = 0, tail = 0, count = 0;
+
+	memset(visited, 0, sizeof(visited));
+
+#define VISIT(mx, my, mr) \
+	if((mx) >= -3 && (mx) <= MAPWIDTH + 2 && !(visited[mr][(mx) + 3] & (1u << (my))) && fits(b, &shapes[type][mr], mx, my)) \
+	{ \
+		visited[mr][(mx) + 3] |= 1u << (my); \
+		queue[tail].x = mx; queue[tail].y = my; queue[tail].rotation = mr; \
+		tail++; \
+	}
+
+	if(start)
+	{
+		VISIT(start->x, start->y, start->rotation);
+	}
+	else
+	{
+		int y = limit - 4 > 0 ? limit - 4 : 0;
+
+		for(int r = 0; r < 4; r++)
+			for(int x = -3; x <= MAPWIDTH + 2; x++)
+			{
+				VISIT(x, y, r);
+			}
+	}
+
+	while(head < tail)
+	{
+		Move m = queue[head++];
+		const Shape *s = &shapes[type][m.rotation];
+
+		VISIT(m.x - 1, m.y, m.rotation);
+		VISIT(m.x + 1, m.y, m.rotation);
+		VISIT(m.x, m.y, (m.rotation + 1) & 3);
+		if(fits(b, s, m.x, m.y + 1))
+		{
+			VISIT(m.x, m.y + 1, m.rotation);
+		}
+		else if(m.y + s->top >= limit)
+		{
+			//the same cells can be reached in several orientations, keep one
+			unsigned long long key = m.y + s->top;
+			int i;
+
+			for(int j = s->top; j <= s->bottom; j++)
+				key = (key << 10) | (((s->rows[j] << (m.x + 3)) >> 3) & 0x3ff);
+			for(i = 0; i < count; i++)
+				if(locks[i] == key)
+					break;
+			if(i == count && count < MAXMOVES)
+			{
+				locks[count] = key;
+				out[count++] = m;
+			}
+		}
+	}
+#undef VISIT
+
+	return count;
+}
+
+// locks the piece and clears full rows, returns the lines cleared
+static int place(Board *b, const Shape *s, int x, int y)
+{
+	int lines = 0, write, read;
+
+	for(int j = s->top; j <= s->bottom; j++)
+		b->rows[y + j] |= s->rows[j] << (x + 3);
+	for(int j = s->top; j <= s->bottom; j++)
+		if(b->rows[y + j] == FULL)
+			lines++;
+	if(lines == 0)
+		return 0;
+
+	for(write = read = MAPHEIGHT - 1; read >= 0; read--)
+		if(b->rows[read] != FULL)
+			b->rows[write--] = b->rows[read];
+	while(write >= 0)
+		b->rows[write--] = WALLS;
+	return lines;
+}
+
+// perfect clear pruning on the rows still to clear. Every empty cell there
+// must be filled by the next n pieces, so the cell count has to come out
+// exactly, the even/odd column balance must be within what those pieces can
+// shift, every empty region must take whole pieces, and a region sealed under
+// blocks needs a row above it finished (and cleared) by the pieces left over
+static bool promising_clear(const SolverJob *job, const Board *b, int depth, int lines)
+{
+	int height = job->height - lines, need = 0, balance = 0, budget = 0, pieces;
+	unsigned int cells[SOLVER_MAXHEIGHT], left[SOLVER_MAXHEIGHT];
+	int empty[SOLVER_MAXHEIGHT];
+
+	for(int r = 0; r < height; r++)
+	{
+		cells[r] = ~(b->rows[MAPHEIGHT - height + r] >> 3) & 0x3ff;
+		empty[r] = popcount(cells[r]);
+		need += empty[r];
+		balance += popcount(cells[r] & 0x155) - popcount(cells[r] & 0x2aa);
+	}
+
+	if(need % 4 != 0)
+		return false;
+	pieces = need / 4;
+	if(depth + pieces > job->count)
+		return false;
+	for(int k = depth; k < depth + pieces; k++)
+		budget += parityLimit[job->types[k]];
+	if(abs(balance) > budget)
+		return false;
+
+	memcpy(left, cells, sizeof(cells));
+	for(;;)
+	{
+		unsigned int region[SOLVER_MAXHEIGHT];
+		int first, size = 0, top = -1;
+		bool grew = true;
+
+		for(first = 0; first < height && left[first] == 0; first++)
+			;
+		if(first == height)
+			break;
+
+		memset(region, 0, sizeof(region));
+		region[first] = left[first] & (0u - left[first]);
+		while(grew)
+		{
+			grew = false;
+			for(int r = 0; r < height; r++)
+			{
+				unsigned int c = region[r];
+
+				c |= ((c << 1) | (c >> 1)) & cells[r];
+				if(r > 0)
+					c |= region[r - 1] & cells[r];
+				if(r < height - 1)
+					c |= region[r + 1] & cells[r];
+				if(c != region[r])
+				{
+					region[r] = c;
+					grew = true;
+				}
+			}
+		}
+
+		for(int r = 0; r < height; r++)
+		{
+			size += popcount(region[r]);
+			if(top < 0 && region[r])
+				top = r;
+			left[r] &= ~region[r];
+		}
+		if(size % 4 != 0)
+			return false;
+
+		if(top > 0)
+		{
+			int spare = pieces - size / 4;
+			bool open = false;
+
+			for(int r = 0; r < top && !open; r++)
+				open = empty[r] <= 4 * spare;
+			if(!open)
+				return false;
+		}
+	}
+	return true;
+}
+
+// line target pruning: the emptiest rows can't be the ones finished, the
+// fullest ones need at least their empty cells from the pieces left
+static bool promising_lines(const SolverJob *job, const Board *b, int depth, int lines)
+{
+	int empty[SOLVER_MAXHEIGHT], need = job->targetLines - lines, cells = 0;
+
+	if(need > job->height)
+		return false;
+	for(int r = 0; r < job->height; r++)
+	{
+		int e = popcount(~(b->rows[MAPHEIGHT - job->height + r] >> 3) & 0x3ff), k;
+
+		for(k = r; k > 0 && empty[k - 1] > e; k--)
+			empty[k] = empty[k - 1];
+		empty[k] = e;
+	}
+	for(int r = 0; r < need; r++)
+		cells += empty[r];
+	return cells <= 4 * (job->count - depth);
+}
+
+static bool search(SearchContext *c, const Board *b, int depth, int lines)
+{
+	SolverJob *job = c->job;
+	unsigned long long key = depth;
+	MemoEntry *slot;
+	Move moves[MAXMOVES];
+	int type, count, limit;
+	bool done;
+
+	if(job->targetLines)
+		done = lines >= job->targetLines;
+	else
+	{
+		done = true;
+		for(int r = MAPHEIGHT - job->height; r < MAPHEIGHT && done; r++)
+			done = b->rows[r] == WALLS;
+	}
+	if(done)
+	{
+		c->count = depth;
+		c->lines = lines;
+		return true;
+	}
+
+	//out of pieces, or another thread already solved an earlier branch
+	if(depth >= job->count || job->best < c->branch)
+		return false;
+	if(!(job->targetLines ? promising_lines(job, b, depth, lines) : promising_clear(job, b, depth, lines)))
+		return false;
+
+	for(int r = MAPHEIGHT - job->height; r < MAPHEIGHT; r++)
+		key = (key << 10) | ((b->rows[r] >> 3) & 0x3ff);
+	slot = &c->memo[(key * 0x9e3779b97f4a7c15ULL) >> (64 - MEMO_BITS)];
+	if(slot->key == key + 1 && slot->lines == lines)
+		return false;
+
+	type = job->types[depth];
+	limit = MAPHEIGHT - (job->targetLines ? job->height : job->height - lines);
+	count = generate(b, type, limit, NULL, moves);
+	for(int i = 0; i < count; i++)
+	{
+		Board next = *b;
+		int cleared = place(&next, &shapes[type][moves[i].rotation], moves[i].x, moves[i].y);
+
+		c->nodes++;
+		c->path[depth].type = type;
+		c->path[depth].rotation = moves[i].rotation;
+		c->path[depth].x = moves[i].x;
+		c->path[depth].y = moves[i].y;
+		if(search(c, &next, depth + 1, lines + cleared))
+			return true;
+	}
+
+	slot->key = key + 1;
+	slot->lines = lines;
+	return false;
+}
+
+static THREADPROC solver_worker(void *arg)
+{
+	SearchContext *c = (SearchContext*)arg;
+	SolverJob *job = c->job;
+
+	for(;;)
+	{
+		int i = atomic_add(&job->next, 1) - 1, type = job->types[0], cleared;
+		Board b = job->root;
+
+		if(i >= job->topCount || i > job->best)
+			break;
+
+		c->branch = i;
+		c->nodes++;
+		cleared = place(&b, &shapes[type][job->topMoves[i].rotation], job->topMoves[i].x, job->topMoves[i].y);
+		c->path[0].type = type;
+		c->path[0].rotation = job->topMoves[i].rotation;
+		c->path[0].x = job->topMoves[i].x;
+		c->path[0].y = job->topMoves[i].y;
+
+		if(search(c, &b, 1, cleared))
+		{
+			mutex_lock(&job->lock);
+			if(i < job->best)
+			{
+				job->best = i;
+				memcpy(job->bestPath, c->path, sizeof(c->path));
+				job->bestCount = c->count;
+				job->bestLines = c->lines;
+			}
+			mutex_unlock(&job->lock);
+		}
+	}
+	return 0;
+}
+
+// one search with the perfect clear (or line) rows fixed at height
+static bool run(SolverJob *job, const Move *start, SearchContext *contexts, int threads, SolverResult *result)
+{
+	int limit = MAPHEIGHT - job->height;
+	int n = 0;
+
+	job->topCount = generate(&job->root, job->types[0], limit, start->y > limit - 4 ? start : NULL, job->topMoves);
+	job->next = 0;
+	job->best = job->topCount;
+	if(threads > job->topCount)
+		threads = job->topCount > 0 ? job->topCount : 1;
+
+	for(int t = 0; t < threads; t++)
+		memset(contexts[t].memo, 0, sizeof(MemoEntry) << MEMO_BITS);
+	for(n = 1; n < threads; n++)
+		if(!thread_create(&contexts[n].thread, solver_worker, &contexts[n]))
+			break;
+	solver_worker(&contexts[0]); // the calling thread searches too
+	for(int t = 1; t < n; t++)
+		thread_join(contexts[t].thread);
+
+	if(job->best == job->topCount)
+		return false;
+	result->found = true;
+	result->count = job->bestCount;
+	result->lines = job->bestLines;
+	memcpy(result->placements, job->bestPath, sizeof(job->bestPath));
+	return true;
+}
+
+bool solve_game(const GameState *g, const int *sequence, int sequenceCount, int maxPieces, int targetLines, int threads, SolverResult *result)
+{
+	static bool shapesReady = false;
+	SearchContext contexts[SOLVER_MAXTHREADS];
+	SolverJob *job;
+	Move start;
+	double startTime = time_usec();
+	int filled = 0, stack = 0, t;
+
+	memset(result, 0, sizeof(SolverResult));
+	if(!shapesReady)
+	{
+		init_shapes();
+		shapesReady = true;
+	}
+
+	job = (SolverJob*)calloc(1, sizeof(SolverJob));
+	if(!job)
+		return false;
+	job->types[0] = piece_type(&g->piece);
+	job->types[1] = piece_type(&g->prePiece);
+	job->count = 2;
+	for(t = 0; t < sequenceCount && job->count < SOLVER_MAXPIECES; t++)
+		job->types[job->count++] = sequence[t];
+	if(maxPieces < job->count)
+		job->count = maxPieces;
+	for(t = 0; t < job->count; t++)
+		if(job->types[t] < 0 || job->types[t] > 6)
+			job->count = 0; // unknown piece, nothing to search
+	job->targetLines = targetLines;
+
+	for(int y = 0; y < MAPHEIGHT; y++)
+	{
+		Row row = WALLS;
+
+		for(int x = 0; x < MAPWIDTH; x++)
+			if(g->map[x][y] != TILEBLACK)
+			{
+				row |= 1 << (x + 3);
+				filled++;
+				if(stack < MAPHEIGHT - y)
+					stack = MAPHEIGHT - y;
+			}
+		job->root.rows[y] = row;
+	}
+	for(int y = MAPHEIGHT; y < MAPHEIGHT + 4; y++)
+		job->root.rows[y] = FULL;
+
+	start.x = g->piece.x;
+	start.y = g->piece.y;
+	start.rotation = g->piece.rotation & 3;
+
+	if(threads <= 0)
+		threads = cpu_count();
+	if(threads > SOLVER_MAXTHREADS)
+		threads = SOLVER_MAXTHREADS;
+	for(t = 0; t < threads; t++)
+	{
+		contexts[t].job = job;
+		contexts[t].nodes = 0;
+		contexts[t].memo = (MemoEntry*)malloc(sizeof(MemoEntry) << MEMO_BITS);
+		if(!contexts[t].memo)
+			break;
+	}
+	threads = t;
+	mutex_init(&job->lock);
+
+	if(threads > 0 && job->count > 0 && stack <= SOLVER_MAXHEIGHT)
+	{
+		if(targetLines)
+		{
+			job->height = SOLVER_MAXHEIGHT;
+			run(job, &start, contexts, threads, result);
+		}
+		else
+		{
+			//the lowest clear the pieces can make exactly, then higher ones
+			for(int h = stack > 0 ? stack : 1; h <= SOLVER_MAXHEIGHT && !result->found; h++)
+				if((10 * h - filled) % 4 == 0 && (10 * h - filled) / 4 <= job->count)
+				{
+					job->height = h;
+					run(job, &start, contexts, threads, result);
+				}
+		}
+	}
+
+	for(t = 0; t < threads; t++)
+	{
+		result->nodes += contexts[t].nodes;
+		free(contexts[t].memo);
+	}
+	mutex_destroy(&job->lock);
+	free(job);
+
+	result->seconds = (time_usec() - startTime) / 1e6;
+	return result->found;
+}
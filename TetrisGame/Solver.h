@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Game.h"
+
+// finishing sequence solver: a depth first search over every placement the
+// rules allow for a known piece sequence, on bitboards, looking for a
+// perfect clear or a number of lines within a piece budget. Boards already
+// shown to fail are remembered, perfect clear searches are pruned by cell
+// count, column parity and hole checks, and the first piece's placements
+// are shared out between threads.
+//
+// Placements are found by flood filling the classic moves (left, right,
+// down, rotate in place) so slides and tucks under overhangs are included.
+
+#define SOLVER_MAXPIECES 15 // current piece and preview included
+#define SOLVER_MAXHEIGHT 6 // rows above the floor the search builds in
+
+struct SolverPlacement { int type, rotation, x, y; }; // where a piece locks, as Piece x/y and rotate_block turns from spawn
+
+struct SolverResult
+{
+	bool found;
+	int count; // placements in the solution
+	int lines; // lines they clear
+	SolverPlacement placements[SOLVER_MAXPIECES];
+	long long nodes; // placements tried
+	double seconds;
+};
+
+// sequence holds the piece types (0..6) after g->piece and g->prePiece. maxPieces counts
+// from g->piece. targetLines 0 asks for a perfect clear. threads 0 uses every core
+bool solve_game(const GameState *g, const int *sequence, int sequenceCount, int maxPieces, int targetLines, int threads, SolverResult *result);
@@ -0,0 +1,318 @@
+#include "Spectator.h"
+#include "Threads.h"
+#include <stdlib.h>
+#include <string.h>
+
+// delta change bits
+#define CHANGED_CELLS 1
+#define CHANGED_POSITION 2
+#define CHANGED_SHAPE 4
+#define CHANGED_PREVIEW 8
+#define CHANGED_FLAGS 16
+
+#define CELLS (MAPWIDTH * MAPHEIGHT) // the floor row never changes so it is not sent
+
+struct BitWriter { unsigned char *data; int bit; };
+struct BitReader { const unsigned char *data; int bit; };
+
+static void put_bits(BitWriter *w, unsigned int value, int count)
+{
+	for(int i = count - 1; i >= 0; i--, w->bit++)
+	{
+		if((w->bit & 7) == 0)
+			w->data[w->bit >> 3] = 0;
+		if((value >> i) & 1)
+			w->data[w->bit >> 3] |= 0x80 >> (w->bit & 7);
+	}
+}
+
+static unsigned int get_bits(BitReader *r, int count)
+{
+	unsigned int value = 0;
+
+	for(int i = 0; i < count; i++, r->bit++)
+		value = (value << 1) | ((r->data[r->bit >> 3] >> (7 - (r->bit & 7))) & 1);
+	return value;
+}
+
+static unsigned int shape_mask(const Piece *p, int *tile)
+{
+	unsigned int mask = 0;
+
+	*tile = TILENODRAW;
+	for(int i = 0; i < 16; i++)
+		if(p->size[i / 4][i % 4] != TILENODRAW)
+		{
+			mask |= 1 << i;
+			*tile = p->size[i / 4][i % 4];
+		}
+	return mask;
+}
+
+static void put_shape(BitWriter *w, const Piece *p)
+{
+	int tile;
+	unsigned int mask = shape_mask(p, &tile);
+
+	put_bits(w, mask, 16);
+	put_bits(w, tile, 4);
+}
+
+static void get_shape(BitReader *r, Piece *p)
+{
+	unsigned int mask = get_bits(r, 16);
+	int tile = get_bits(r, 4);
+
+	for(int i = 0; i < 16; i++)
+		p->size[i / 4][i % 4] = (unsigned char)((mask >> i) & 1 ? tile : TILENODRAW);
+}
+
+static bool same_shape(const Piece *a, const Piece *b)
+{
+	return memcmp(a->size, b->size, sizeof(a->size)) == 0;
+}
+
+void spectator_init(SpectatorFeed *f)
+{
+	memset(f, 0, sizeof(SpectatorFeed));
+}
+
+SpectatorPacket* spectator_encode(SpectatorFeed *f, const GameState *g)
+{
+	SpectatorPacket *p = (SpectatorPacket*) malloc(sizeof(SpectatorPacket));
+	BitWriter w = { p->data, 0 };
+	const GameState *old = &f->sent;
+	int x, y;
+
+	p->refs = 1;
+	p->tick = f->ticks;
+	p->keyframe = f->ticks % SPECTATOR_KEYFRAME == 0 || g->score < old->score;
+	put_bits(&w, p->keyframe, 1);
+
+	if(p->keyframe)
+	{
+		put_bits(&w, p->tick, 32);
+		for(x = 0; x < MAPWIDTH; x++)
+			for(y = 0; y < MAPHEIGHT; y++)
+				put_bits(&w, g->map[x][y], 4);
+		put_bits(&w, g->piece.x + 4, 5);
+		put_bits(&w, g->piece.y + 4, 6);
+		put_shape(&w, &g->piece);
+		put_shape(&w, &g->prePiece);
+		put_bits(&w, g->score, 32);
+		put_bits(&w, g->gameStarted, 1);
+		put_bits(&w, g->danger, 1);
+	}
+	else
+	{
+		unsigned char changed[CELLS];
+		int changedCount = 0, what = 0, scoreStep = g->score - old->score;
+
+		for(x = 0; x < MAPWIDTH; x++)
+			for(y = 0; y < MAPHEIGHT; y++)
+				if(g->map[x][y] != old->map[x][y])
+					changed[changedCount++] = (unsigned char)(x * MAPHEIGHT + y);
+
+		if(changedCount > 0)
+			what |= CHANGED_CELLS;
+		if(g->piece.x != old->piece.x || g->piece.y != old->piece.y)
+			what |= CHANGED_POSITION;
+		if(!same_shape(&g->piece, &old->piece))
+			what |= CHANGED_SHAPE;
+		if(!same_shape(&g->prePiece, &old->prePiece))
+			what |= CHANGED_PREVIEW;
+		if(g->gameStarted != old->gameStarted || g->danger != old->danger)
+			what |= CHANGED_FLAGS;
+		put_bits(&w, what, 5);
+
+		//a line clear moves most of the board, then the whole map is smaller than a list
+		if(what & CHANGED_CELLS)
+		{
+			if(changedCount * 12 < CELLS * 4)
+			{
+				put_bits(&w, 0, 1);
+				put_bits(&w, changedCount, 8);
+				for(int i = 0; i < changedCount; i++)
+				{
+					put_bits(&w, changed[i], 8);
+					put_bits(&w, g->map[changed[i] / MAPHEIGHT][changed[i] % MAPHEIGHT], 4);
+				}
+			}
+			else
+			{
+				put_bits(&w, 1, 1);
+				for(x = 0; x < MAPWIDTH; x++)
+					for(y = 0; y < MAPHEIGHT; y++)
+						put_bits(&w, g->map[x][y], 4);
+			}
+		}
+		if(what & CHANGED_POSITION)
+		{
+			put_bits(&w, g->piece.x + 4, 5);
+			put_bits(&w, g->piece.y + 4, 6);
+		}
+		if(what & CHANGED_SHAPE)
+			put_shape(&w, &g->piece);
+		if(what & CHANGED_PREVIEW)
+			put_shape(&w, &g->prePiece);
+		if(what & CHANGED_FLAGS)
+		{
+			put_bits(&w, g->gameStarted, 1);
+			put_bits(&w, g->danger, 1);
+		}
+
+		//score goes up by one nearly every tick, anything else costs a length and the step
+		if(scoreStep == 1)
+			put_bits(&w, 1, 1);
+		else
+		{
+			int length = 0;
+			while(length < 31 && (scoreStep >> length) != 0)
+				length++;
+			put_bits(&w, 0, 1);
+			put_bits(&w, length, 5);
+			put_bits(&w, scoreStep, length);
+		}
+	}
+
+	p->bytes = (w.bit + 7) / 8;
+	f->sent = *g;
+	f->ticks++;
+	f->packets++;
+	f->bytes += p->bytes;
+	return p;
+}
+
+void spectator_subscribe(SpectatorFeed *f, SpectatorSubscriber *s)
+{
+	memset(s, 0, sizeof(SpectatorSubscriber));
+	if(f->subscriberCount < SPECTATOR_MAXSUBS)
+		f->subscribers[f->subscriberCount++] = s;
+}
+
+void spectator_publish(SpectatorFeed *f, SpectatorPacket *p)
+{
+	int i, queued = 0;
+
+	//take every subscriber's reference up front so no reader can free it under us
+	atomic_add(&p->refs, f->subscriberCount);
+
+	for(i = 0; i < f->subscriberCount; i++)
+	{
+		SpectatorSubscriber *s = f->subscribers[i];
+
+		if(!s->synced && !p->keyframe)
+			continue;
+		if(s->head - s->tail >= SPECTATOR_QUEUE)
+		{
+			//the reader fell behind, it skips to the next keyframe
+			s->synced = false;
+			s->dropped++;
+			continue;
+		}
+		s->queue[s->head % SPECTATOR_QUEUE] = p;
+		atomic_add(&s->head, 1); // publishes the slot to the reader
+		s->synced = true;
+		queued++;
+	}
+
+	//references for subscribers that skipped the packet, plus our own
+	if(atomic_add(&p->refs, -(f->subscriberCount - queued) - 1) == 0)
+		free(p);
+}
+
+SpectatorPacket* spectator_next(SpectatorSubscriber *s)
+{
+	SpectatorPacket *p;
+
+	if(s->tail == s->head)
+		return NULL;
+	p = s->queue[s->tail % SPECTATOR_QUEUE];
+	atomic_add(&s->tail, 1);
+	return p;
+}
+
+void spectator_release(SpectatorPacket *p)
+{
+	if(atomic_add(&p->refs, -1) == 0)
+		free(p);
+}
+
+bool spectator_apply(GameState *view, bool *synced, const SpectatorPacket *p)
+{
+	BitReader r = { p->data, 0 };
+	int x, y;
+
+	if(get_bits(&r, 1))
+	{
+		memset(view, 0, sizeof(GameState));
+		view->tick = get_bits(&r, 32);
+		for(x = 0; x < MAPWIDTH; x++)
+		{
+			for(y = 0; y < MAPHEIGHT; y++)
+				view->map[x][y] = (unsigned char)get_bits(&r, 4);
+			view->map[x][MAPHEIGHT] = TILEGREY;
+		}
+		view->piece.x = (int)get_bits(&r, 5) - 4;
+		view->piece.y = (int)get_bits(&r, 6) - 4;
+		get_shape(&r, &view->piece);
+		get_shape(&r, &view->prePiece);
+		view->score = (int)get_bits(&r, 32);
+		view->gameStarted = get_bits(&r, 1) != 0;
+		view->danger = get_bits(&r, 1) != 0;
+		*synced = true;
+	}
+	else
+	{
+		int what;
+
+		if(!*synced)
+			return false;
+
+		what = get_bits(&r, 5);
+		if(what & CHANGED_CELLS)
+		{
+			if(get_bits(&r, 1) == 0)
+			{
+				int count = get_bits(&r, 8);
+				for(int i = 0; i < count; i++)
+				{
+					int cell = get_bits(&r, 8);
+					view->map[cell / MAPHEIGHT][cell % MAPHEIGHT] = (unsigned char)get_bits(&r, 4);
+				}
+			}
+			else
+			{
+				for(x = 0; x < MAPWIDTH; x++)
+					for(y = 0; y < MAPHEIGHT; y++)
+						view->map[x][y] = (unsigned char)get_bits(&r, 4);
+			}
+		}
+		if(what & CHANGED_POSITION)
+		{
+			view->piece.x = (int)get_bits(&r, 5) - 4;
+			view->piece.y = (int)get_bits(&r, 6) - 4;
+		}
+		if(what & CHANGED_SHAPE)
+			get_shape(&r, &view->piece);
+		if(what & CHANGED_PREVIEW)
+			get_shape(&r, &view->prePiece);
+		if(what & CHANGED_FLAGS)
+		{
+			view->gameStarted = get_bits(&r, 1) != 0;
+			view->danger = get_bits(&r, 1) != 0;
+		}
+		if(get_bits(&r, 1))
+			view->score++;
+		else
+		{
+			int length = get_bits(&r, 5);
+			view->score += (int)get_bits(&r, length);
+		}
+		view->tick++;
+	}
+
+	view->prePiece.x = MAPWIDTH + 2;
+	view->prePiece.y = MAPHEIGHT - 4;
+	return true;
+}
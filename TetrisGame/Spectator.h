@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Game.h"
+
+// spectator feed: one bit-packed packet per tick holding only what changed
+// (cells, piece position/shape, preview, score, flags) with a full keyframe
+// every SPECTATOR_KEYFRAME ticks so late joiners can sync. Each packet is
+// encoded once and the same buffer is queued to every subscriber, it is
+// freed when the last one releases it.
+
+#define SPECTATOR_KEYFRAME 120 // ticks between keyframes, the longest a late joiner waits
+#define SPECTATOR_QUEUE 64 // packets a subscriber may fall behind before it has to resync
+#define SPECTATOR_MAXPACKET 128 // bytes, a keyframe is the largest packet
+#define SPECTATOR_MAXSUBS 4096
+
+struct SpectatorPacket
+{
+	volatile long refs; // publisher plus every subscriber still holding it
+	unsigned int tick;
+	bool keyframe;
+	int bytes;
+	unsigned char data[SPECTATOR_MAXPACKET];
+};
+
+// one reader, its queue is filled by the publisher and drained by the reader
+struct SpectatorSubscriber
+{
+	SpectatorPacket *queue[SPECTATOR_QUEUE];
+	volatile long head, tail; // publisher advances head, reader advances tail
+	bool synced; // had a keyframe and no gaps since
+	long dropped; // packets lost because the queue was full
+};
+
+struct SpectatorFeed
+{
+	GameState sent; // the state spectators have after the last packet
+	unsigned int ticks;
+	SpectatorSubscriber *subscribers[SPECTATOR_MAXSUBS];
+	int subscriberCount;
+	long packets;
+	double bytes; // total encoded, not multiplied by subscribers
+};
+
+void spectator_init(SpectatorFeed *f);
+SpectatorPacket* spectator_encode(SpectatorFeed *f, const GameState *g); //packet for this tick, owned by the caller until published
+void spectator_publish(SpectatorFeed *f, SpectatorPacket *p); //queues p to every subscriber and drops the caller's reference
+void spectator_subscribe(SpectatorFeed *f, SpectatorSubscriber *s); //call from the publishing thread, s starts at the next keyframe
+SpectatorPacket* spectator_next(SpectatorSubscriber *s); //oldest queued packet or NULL, release it when done
+void spectator_release(SpectatorPacket *p);
+bool spectator_apply(GameState *view, bool *synced, const SpectatorPacket *p); //updates a viewer's copy of the board
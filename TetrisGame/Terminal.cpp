@@ -0,0 +1,321 @@
+#include "Terminal.h"
+#include "Metrics.h"
+#include "Threads.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004 // missing from SDKs before Windows 10
+#endif
+#else
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+#define COLOR_TEXT (TILEAQUA + 1) // white, for text only
+#define NOCOLOR 255
+#define ESCAPE_WAIT_MSEC 50 // an ESC with nothing after it for this long is the Esc key
+
+// one character cell of the terminal
+struct TermCell { char ch; unsigned char fg, bg; };
+
+static TermCell screen[TERM_ROWS][TERM_COLS]; // what the terminal shows now
+static TermCell next[TERM_ROWS][TERM_COLS]; // the frame being composed
+static char out[TERM_ROWS * TERM_COLS * 48]; // worst case: every cell moves the cursor and sets both colours
+static bool opened = false;
+
+#ifdef _WIN32
+static HANDLE console, keyboard;
+static DWORD oldOutMode, oldInMode;
+#else
+static struct termios oldTermios;
+static unsigned char pending[16]; // start of an escape sequence the last read split
+static int pendingCount;
+static double pendingSince; // when pending last grew
+#endif
+
+static void write_out(const char *data, int len)
+{
+#ifdef _WIN32
+	DWORD written;
+	WriteFile(console, data, len, &written, NULL);
+#else
+	while(len > 0)
+	{
+		int n = (int)write(STDOUT_FILENO, data, len);
+		if(n <= 0)
+			break;
+		data += n;
+		len -= n;
+	}
+#endif
+}
+
+bool terminal_open(void)
+{
+	static const char setup[] = "\x1b[?25l\x1b[0m\x1b[2J"; // hide cursor, reset colours, clear
+
+#ifdef _WIN32
+	console = GetStdHandle(STD_OUTPUT_HANDLE);
+	keyboard = GetStdHandle(STD_INPUT_HANDLE);
+	if(console == INVALID_HANDLE_VALUE || !GetConsoleMode(console, &oldOutMode))
+		return false;
+	if(!SetConsoleMode(console, oldOutMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING))
+		return false;
+	GetConsoleMode(keyboard, &oldInMode);
+	SetConsoleMode(keyboard, 0); // raw key events
+#else
+	struct termios raw;
+
+	if(tcgetattr(STDIN_FILENO, &oldTermios) != 0)
+		return false;
+	raw = oldTermios;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+#endif
+
+	//nothing is known about the screen, so every cell differs on the first frame
+	memset(screen, NOCOLOR, sizeof(screen));
+	write_out(setup, sizeof(setup) - 1);
+	opened = true;
+	return true;
+}
+
+void terminal_close(void)
+{
+	static const char restore[] = "\x1b[0m\x1b[?25h\r\n";
+
+	if(!opened)
+		return;
+	write_out(restore, sizeof(restore) - 1);
+#ifdef _WIN32
+	SetConsoleMode(console, oldOutMode);
+	SetConsoleMode(keyboard, oldInMode);
+#else
+	tcsetattr(STDIN_FILENO, TCSANOW, &oldTermios);
+#endif
+	opened = false;
+}
+
+// board tiles are two characters wide so they come out roughly square
+static void put_tile(int row, int col, int tile)
+{
+	if(row < 0 || row >= TERM_ROWS || col < 0 || col + 1 >= TERM_COLS)
+		return;
+	next[row][col].ch = next[row][col + 1].ch = ' ';
+	next[row][col].fg = next[row][col + 1].fg = COLOR_TEXT;
+	next[row][col].bg = next[row][col + 1].bg = (unsigned char)tile;
+}
+
+static void put_text(int row, int col, const char *text)
+{
+	for(; *text && col < TERM_COLS; text++, col++)
+	{
+		next[row][col].ch = *text;
+		next[row][col].fg = COLOR_TEXT;
+		next[row][col].bg = TILEBLACK;
+	}
+}
+
+// same layout as the 3D view: borders round the map, preview to the right
+static void compose(const GameState *g)
+{
+	char text[32];
+	int i, j;
+
+	for(i = 0; i < TERM_ROWS; i++)
+		for(j = 0; j < TERM_COLS; j++)
+		{
+			next[i][j].ch = ' ';
+			next[i][j].fg = COLOR_TEXT;
+			next[i][j].bg = TILEBLACK;
+		}
+
+	//map cell (x, y) is at row y + 2, column (x + 1) * 2, leaving row 0 for the score
+	for(i = -1; i <= MAPWIDTH; i++)
+		put_tile(1, (i + 1) * 2, TILEGREY);
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+	{
+		put_tile(j + 2, 0, TILEGREY);
+		put_tile(j + 2, (MAPWIDTH + 1) * 2, TILEGREY);
+		for(i = 0; i < MAPWIDTH; i++)
+			put_tile(j + 2, (i + 1) * 2, g->map[i][j]);
+	}
+
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+		{
+			if(g->piece.size[i][j] != TILENODRAW)
+				put_tile(g->piece.y + j + 2, (g->piece.x + i + 1) * 2, g->piece.size[i][j]);
+			if(g->prePiece.size[i][j] != TILENODRAW)
+				put_tile(g->prePiece.y + j + 2, (g->prePiece.x + i + 1) * 2, g->prePiece.size[i][j]);
+		}
+
+	sprintf(text, "Score:%d", g->score);
+	put_text(0, 0, text);
+
+	if(!g->gameStarted)
+		put_text(MAPHEIGHT / 2 + 2, MAPWIDTH - 3, "Game Over!");
+	else
+		put_text(g->prePiece.y, (MAPWIDTH + 3) * 2, "Next Piece");
+}
+
+static int append_color(char *p, bool background, int color)
+{
+	const unsigned char *rgb = color == COLOR_TEXT ? (const unsigned char*)"\xff\xff\xff" : tileColors[color];
+	return sprintf(p, "\x1b[%d;2;%d;%d;%dm", background ? 48 : 38, rgb[0], rgb[1], rgb[2]);
+}
+
+int terminal_render(const GameState *g)
+{
+	int row, col, n = 0, cursorRow = -1, cursorCol = -1, fg = NOCOLOR, bg = NOCOLOR;
+
+	compose(g);
+
+	for(row = 0; row < TERM_ROWS; row++)
+	{
+		for(col = 0; col < TERM_COLS; col++)
+		{
+			TermCell *want = &next[row][col], *have = &screen[row][col];
+
+			if(want->ch == have->ch && want->bg == have->bg && (want->fg == have->fg || want->ch == ' '))
+				continue;
+
+			//the cursor only needs moving when we skipped unchanged cells
+			if(row != cursorRow || col != cursorCol)
+				n += sprintf(out + n, "\x1b[%d;%dH", row + 1, col + 1);
+			if(want->bg != bg)
+				n += append_color(out + n, true, bg = want->bg);
+			if(want->ch != ' ' && want->fg != fg)
+				n += append_color(out + n, false, fg = want->fg);
+			out[n++] = want->ch;
+
+			*have = *want;
+			cursorRow = row;
+			cursorCol = col + 1;
+		}
+	}
+
+	if(n > 0)
+		write_out(out, n);
+	return n;
+}
+
+int terminal_input(bool *quit)
+{
+	int input = 0;
+
+#ifdef _WIN32
+	DWORD pending, count;
+	INPUT_RECORD record;
+
+	while(GetNumberOfConsoleInputEvents(keyboard, &pending) && pending > 0 && ReadConsoleInputW(keyboard, &record, 1, &count))
+	{
+		if(record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown)
+			continue;
+		switch(record.Event.KeyEvent.wVirtualKeyCode)
+		{
+			case VK_LEFT: input |= INPUT_LEFT; break;
+			case VK_RIGHT: input |= INPUT_RIGHT; break;
+			case VK_DOWN: input |= INPUT_DOWN; break;
+			case VK_SPACE: input |= INPUT_ROTATE; break;
+			case VK_ESCAPE: case 'Q': *quit = true; break;
+		}
+	}
+#else
+	unsigned char keys[sizeof(pending) + 64];
+	int len, got;
+
+	//a sequence split over reads (SSH, or a full buffer) goes on from where it stopped
+	memcpy(keys, pending, pendingCount);
+	got = (int)read(STDIN_FILENO, keys + pendingCount, 64);
+	len = pendingCount + (got > 0 ? got : 0);
+	if(got > 0)
+		pendingSince = time_usec();
+	pendingCount = 0;
+
+	for(int i = 0; i < len; i++)
+	{
+		if(keys[i] == 0x1b)
+		{
+			int end = i + 1;
+
+			//arrow keys arrive as ESC [ A..D or ESC O A..D, maybe with modifier
+			//parameters before the final letter
+			if(end < len && (keys[end] == '[' || keys[end] == 'O'))
+			{
+				for(end++; end < len && keys[end] >= 0x20 && keys[end] < 0x40; end++)
+					;
+				if(end < len)
+				{
+					switch(keys[end])
+					{
+						case 'B': input |= INPUT_DOWN; break;
+						case 'C': input |= INPUT_RIGHT; break;
+						case 'D': input |= INPUT_LEFT; break;
+					}
+					i = end;
+					continue;
+				}
+			}
+			else if(end < len)
+				continue; // Alt and a key, the key is read on its own
+
+			//the sequence runs off the end of what we have: wait for the rest,
+			//unless nothing has come for a while, when a lone ESC is the Esc key
+			if(time_usec() - pendingSince < ESCAPE_WAIT_MSEC * 1000.0 && len - i <= (int)sizeof(pending))
+			{
+				pendingCount = len - i;
+				memcpy(pending, keys + i, pendingCount);
+			}
+			else if(len - i == 1)
+				*quit = true;
+			break;
+		}
+		else if(keys[i] == ' ')
+			input |= INPUT_ROTATE;
+		else if(keys[i] == 'q')
+			*quit = true;
+	}
+#endif
+	return input;
+}
+
+int terminal_play(unsigned int seed, const RuleVariant *rules)
+{
+	GameState game;
+	bool quit = false;
+	int bytesMetric, frames = 0;
+	double next, bytes = 0.0;
+
+	if(!terminal_open())
+		return 1;
+
+	bytesMetric = metric_register("tetris_terminal_bytes_per_frame", "Bytes written to the terminal per frame.", METRIC_HISTOGRAM);
+	rules->init(&game, seed);
+	next = time_usec();
+
+	while(!quit)
+	{
+		rules->step(&game, terminal_input(&quit));
+
+		int n = terminal_render(&game);
+		metric_observe(bytesMetric, n);
+		bytes += n;
+		frames++;
+
+		//fixed rate, sleep off whatever is left of this tick
+		next += 1e6 / TICKRATE;
+		double wait = next - time_usec();
+		if(wait > 0)
+			sleep_msec((int)(wait / 1000));
+	}
+
+	terminal_close();
+	printf("%d frames, %.1f bytes/frame average, p99 %.0f bytes\n", frames, bytes / (frames ? frames : 1), metric_quantile(bytesMetric, 0.99));
+	return 0;
+}
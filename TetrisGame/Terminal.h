@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Game.h"
+#include "Rules.h"
+
+// ANSI terminal renderer for playing or watching without a GPU, e.g. over SSH.
+// A shadow copy of the screen is kept and each frame only the escape
+// sequences for cells that changed are written, in a single write call.
+
+#define TERM_COLS 44
+#define TERM_ROWS 24
+
+bool terminal_open(void); //raw keyboard input, hides the cursor
+void terminal_close(void); //restores the terminal
+int terminal_render(const GameState *g); //draws the game, returns the bytes written
+int terminal_input(bool *quit); //INPUT_* bits for keys pressed since the last call
+int terminal_play(unsigned int seed, const RuleVariant *rules); //plays a game in the terminal at TICKRATE until q or Esc
@@ -0,0 +1,29 @@
+// entry point for the headless terminal build, e.g. on a Linux server:
+//   g++ -O2 TerminalMain.cpp Terminal.cpp Game.cpp Rules.cpp Metrics.cpp Analytics.cpp -lpthread -o tetris
+//   ./tetris [rules [analytics prefix]]
+// the Windows build reaches the same code with "TetrisGame.exe -terminal [-rules name] [-analytics prefix]"
+#include "Terminal.h"
+#include "Analytics.h"
+#include <stdio.h>
+#include <time.h>
+
+int main(int argc, char **argv)
+{
+	const RuleVariant *rules = find_rules(argc > 1 ? argv[1] : "classic");
+	int result;
+
+	if(!rules)
+	{
+		int count;
+		const RuleVariant *all = rule_variants(&count);
+
+		for(int i = 0; i < count; i++)
+			printf("%-10s %s\n", all[i].name, all[i].description);
+		return 1;
+	}
+	if(argc > 2)
+		analytics_start(argv[2], 64 << 20); // every locked piece to prefix000.tpa...
+	result = terminal_play((unsigned int)time(NULL), rules);
+	analytics_stop();
+	return result;
+}
@@ -0,0 +1,302 @@
+#include "TetrisEnv.h"
+#include "Game.h"
+#include "Rules.h"
+#include "Analytics.h"
+#include "Threads.h"
+#include <stdlib.h>
+
+#define ENV_MAXTHREADS 64
+
+struct TetrisEnv
+{
+	GameState *games;
+	const RuleVariant *rules;
+	int count;
+	int ticksPerStep;
+	unsigned int nextSeed; // seed for the next auto reset
+
+	// the current call's arguments, read by the workers
+	const unsigned char *actions;
+	unsigned char *boards, *pieces, *dones;
+	float *features, *rewards;
+
+	// worker pool: each worker owns a fixed slice of the games
+	Thread threads[ENV_MAXTHREADS];
+	int threadCount;
+	Mutex lock;
+	CondVar start, finished;
+	int generation; // bumped for every step so workers know there is work
+	int pending; // slices not yet taken by a worker
+	int running; // slices not yet finished
+	bool quit;
+};
+
+static void observe(TetrisEnv *env, int i)
+{
+	const GameState *g = &env->games[i];
+	int x, y;
+
+	if(env->boards)
+	{
+		unsigned char *board = env->boards + (size_t)i * ENV_BOARD_SIZE;
+		for(y = 0; y < MAPHEIGHT; y++)
+			for(x = 0; x < MAPWIDTH; x++)
+				board[y * MAPWIDTH + x] = g->map[x][y] != TILEBLACK;
+	}
+
+	if(env->pieces)
+	{
+		unsigned char *piece = env->pieces + (size_t)i * ENV_PIECE_SIZE;
+		for(y = 0; y < 4; y++)
+			for(x = 0; x < 4; x++)
+			{
+				piece[y * 4 + x] = g->piece.size[x][y] != TILENODRAW;
+				piece[16 + y * 4 + x] = g->prePiece.size[x][y] != TILENODRAW;
+			}
+	}
+
+	if(env->features)
+	{
+		float *f = env->features + (size_t)i * ENV_FEATURES;
+		int heights[MAPWIDTH], total = 0, highest = 0, holes = 0, bumpiness = 0;
+
+		for(x = 0; x < MAPWIDTH; x++)
+		{
+			heights[x] = 0;
+			for(y = 0; y < MAPHEIGHT; y++)
+			{
+				if(g->map[x][y] == TILEBLACK)
+				{
+					if(heights[x] > 0)
+						holes++;
+				}
+				else if(heights[x] == 0)
+					heights[x] = MAPHEIGHT - y;
+			}
+			total += heights[x];
+			if(heights[x] > highest)
+				highest = heights[x];
+			if(x > 0)
+				bumpiness += abs(heights[x] - heights[x - 1]);
+		}
+
+		f[ENV_FEATURE_X] = (float)g->piece.x;
+		f[ENV_FEATURE_Y] = (float)g->piece.y;
+		f[ENV_FEATURE_HEIGHT] = (float)total;
+		f[ENV_FEATURE_MAXHEIGHT] = (float)highest;
+		f[ENV_FEATURE_HOLES] = (float)holes;
+		f[ENV_FEATURE_BUMPINESS] = (float)bumpiness;
+		f[ENV_FEATURE_LINES] = (float)g->lines;
+		f[ENV_FEATURE_DANGER] = g->danger ? 1.0f : 0.0f;
+	}
+}
+
+// splitmix64 of the pair, so games with neighbouring seeds or indices don't
+// start from related randomizer states
+static unsigned int mix_seed(unsigned int seed, unsigned int i)
+{
+	unsigned long long z = ((unsigned long long)seed << 32 | i) + 0x9E3779B97F4A7C15ull;
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return (unsigned int)(z ^ (z >> 31));
+}
+
+static unsigned int reset_seed(TetrisEnv *env, int i)
+{
+	// distinct per game and per reset, without sharing a counter between threads
+	return mix_seed(mix_seed(env->nextSeed, (unsigned int)i), env->games[i].pieces);
+}
+
+static void step_range(TetrisEnv *env, int first, int last)
+{
+	for(int i = first; i < last; i++)
+	{
+		GameState *g = &env->games[i];
+		int lines = g->lines;
+
+		env->rules->step(g, env->actions ? env->actions[i] : 0);
+		for(int t = 1; t < env->ticksPerStep && g->gameStarted; t++)
+			env->rules->step(g, 0);
+
+		if(env->rewards)
+			env->rewards[i] = (float)(g->lines - lines);
+		if(env->dones)
+			env->dones[i] = !g->gameStarted;
+		if(!g->gameStarted)
+			env->rules->init(g, reset_seed(env, i));
+
+		observe(env, i);
+	}
+}
+
+static void step_slice(TetrisEnv *env, int slice)
+{
+	int slices = env->threadCount + 1;
+	step_range(env, (int)((long long)env->count * slice / slices), (int)((long long)env->count * (slice + 1) / slices));
+}
+
+static THREADPROC env_worker(void *arg)
+{
+	TetrisEnv *env = (TetrisEnv*)arg;
+	int seen = 0;
+
+	for(;;)
+	{
+		int slice;
+
+		mutex_lock(&env->lock);
+		while(env->generation == seen && !env->quit)
+			cond_wait(&env->start, &env->lock);
+		if(env->quit)
+		{
+			mutex_unlock(&env->lock);
+			break;
+		}
+		seen = env->generation;
+		slice = --env->pending; // slices are handed out in arrival order
+		mutex_unlock(&env->lock);
+
+		step_slice(env, slice);
+
+		mutex_lock(&env->lock);
+		if(--env->running == 0)
+			cond_signal(&env->finished);
+		mutex_unlock(&env->lock);
+	}
+	return 0;
+}
+
+static void run(TetrisEnv *env, const unsigned char *actions, unsigned char *boards, unsigned char *pieces,
+	float *features, float *rewards, unsigned char *dones)
+{
+	env->actions = actions;
+	env->boards = boards;
+	env->pieces = pieces;
+	env->features = features;
+	env->rewards = rewards;
+	env->dones = dones;
+
+	if(env->threadCount == 0)
+	{
+		step_range(env, 0, env->count);
+		return;
+	}
+
+	mutex_lock(&env->lock);
+	env->pending = env->threadCount;
+	env->running = env->threadCount;
+	env->generation++;
+	cond_broadcast(&env->start);
+	mutex_unlock(&env->lock);
+
+	// the calling thread takes the last slice instead of sitting idle
+	step_slice(env, env->threadCount);
+
+	mutex_lock(&env->lock);
+	while(env->running > 0)
+		cond_wait(&env->finished, &env->lock);
+	mutex_unlock(&env->lock);
+}
+
+TetrisEnv* tetris_env_create(int count, unsigned int seed, int ticksPerStep, int threads)
+{
+	TetrisEnv *env;
+
+	if(count <= 0)
+		return NULL;
+	env = (TetrisEnv*)calloc(1, sizeof(TetrisEnv));
+	if(!env)
+		return NULL;
+	env->games = (GameState*)malloc(sizeof(GameState) * count);
+	if(!env->games)
+	{
+		free(env);
+		return NULL;
+	}
+	env->count = count;
+	env->ticksPerStep = ticksPerStep > 0 ? ticksPerStep : 1;
+	env->nextSeed = seed;
+	env->rules = find_rules("classic");
+	for(int i = 0; i < count; i++)
+		init_game(&env->games[i], mix_seed(seed, (unsigned int)i));
+
+	if(threads <= 0)
+		threads = cpu_count();
+	if(threads > count)
+		threads = count;
+	if(threads > ENV_MAXTHREADS)
+		threads = ENV_MAXTHREADS;
+
+	mutex_init(&env->lock);
+	cond_init(&env->start);
+	cond_init(&env->finished);
+	for(int i = 0; i < threads - 1; i++)
+	{
+		if(!thread_create(&env->threads[i], env_worker, env))
+			break;
+		env->threadCount++;
+	}
+	return env;
+}
+
+void tetris_env_destroy(TetrisEnv *env)
+{
+	if(!env)
+		return;
+
+	mutex_lock(&env->lock);
+	env->quit = true;
+	cond_broadcast(&env->start);
+	mutex_unlock(&env->lock);
+	for(int i = 0; i < env->threadCount; i++)
+		thread_join(env->threads[i]);
+
+	cond_destroy(&env->finished);
+	cond_destroy(&env->start);
+	mutex_destroy(&env->lock);
+	free(env->games);
+	free(env);
+}
+
+int tetris_env_count(const TetrisEnv *env)
+{
+	return env->count;
+}
+
+int tetris_env_set_rules(TetrisEnv *env, const char *name)
+{
+	const RuleVariant *rules = find_rules(name);
+
+	if(!rules)
+		return 0;
+	env->rules = rules;
+	return 1;
+}
+
+int tetris_env_analytics(const char *prefix)
+{
+	analytics_stop();
+	if(!prefix)
+		return 1;
+	return analytics_start(prefix, 64 << 20) ? 1 : 0;
+}
+
+void tetris_env_reset(TetrisEnv *env, unsigned char *boards, unsigned char *pieces, float *features)
+{
+	env->boards = boards;
+	env->pieces = pieces;
+	env->features = features;
+	for(int i = 0; i < env->count; i++)
+	{
+		env->rules->init(&env->games[i], reset_seed(env, i));
+		observe(env, i);
+	}
+	env->nextSeed += (unsigned int)env->count;
+}
+
+void tetris_env_step(TetrisEnv *env, const unsigned char *actions,
+	unsigned char *boards, unsigned char *pieces, float *features, float *rewards, unsigned char *dones)
+{
+	run(env, actions, boards, pieces, features, rewards, dones);
+}
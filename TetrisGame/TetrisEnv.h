@@ -0,0 +1,61 @@
+#pragma once
+
+// C API for reinforcement learning: one handle owns N independent games and
+// steps all of them per call. Observations are written straight into
+// caller-provided arrays laid out for numpy, so bindings need no copies.
+// Finished games reset themselves, the observation returned for them is the
+// first one of the new game.
+
+#ifdef TETRISENV_EXPORTS
+#define TETRISENV_API __declspec(dllexport)
+#elif defined(TETRISENV_IMPORTS)
+#define TETRISENV_API __declspec(dllimport)
+#else
+#define TETRISENV_API
+#endif
+
+// per game observation sizes
+#define ENV_BOARD_SIZE 200 // MAPHEIGHT rows of MAPWIDTH bytes, 1 where a block has locked
+#define ENV_PIECE_SIZE 32 // active piece 4x4 then preview 4x4, 1 where filled
+#define ENV_FEATURES 8 // floats, see ENV_FEATURE_*
+
+#define ENV_FEATURE_X 0 // active piece column
+#define ENV_FEATURE_Y 1 // active piece row
+#define ENV_FEATURE_HEIGHT 2 // sum of column heights
+#define ENV_FEATURE_MAXHEIGHT 3
+#define ENV_FEATURE_HOLES 4 // empty cells with a block above them
+#define ENV_FEATURE_BUMPINESS 5 // sum of height differences between neighbouring columns
+#define ENV_FEATURE_LINES 6 // lines cleared this game
+#define ENV_FEATURE_DANGER 7
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TetrisEnv TetrisEnv;
+
+// ticksPerStep runs that many engine ticks per step, the action applies on the first.
+// threads 0 uses every core, 1 steps on the calling thread only
+TETRISENV_API TetrisEnv* tetris_env_create(int count, unsigned int seed, int ticksPerStep, int threads);
+TETRISENV_API void tetris_env_destroy(TetrisEnv *env);
+TETRISENV_API int tetris_env_count(const TetrisEnv *env);
+
+// switches every game to a Rules.h variant by name ("classic", "modern"...),
+// takes effect from the next reset, returns 0 if there is no such variant
+TETRISENV_API int tetris_env_set_rules(TetrisEnv *env, const char *name);
+
+// logs every lock of every game in every env to prefix000.tpa, prefix001.tpa...
+// (Analytics.h), NULL stops and flushes the log. Returns 0 if it did not start
+TETRISENV_API int tetris_env_analytics(const char *prefix);
+
+// observation arrays hold count entries each and may be NULL when not wanted:
+// boards [count][ENV_BOARD_SIZE], pieces [count][ENV_PIECE_SIZE], features [count][ENV_FEATURES]
+TETRISENV_API void tetris_env_reset(TetrisEnv *env, unsigned char *boards, unsigned char *pieces, float *features);
+
+// actions [count] of INPUT_* bits, rewards [count] lines cleared this step, dones [count] 1 if the game ended
+TETRISENV_API void tetris_env_step(TetrisEnv *env, const unsigned char *actions,
+	unsigned char *boards, unsigned char *pieces, float *features, float *rewards, unsigned char *dones);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,6 +6,22 @@
 #include <windowsx.h>
 #include <d3d9.h>
 #include <d3dx9.h>
+#include <xmmintrin.h>
+#include "Analytics.h"
+#include "Capture.h"
+#include "Game.h"
+#include "Metrics.h"
+#include "Perft.h"
+#include "Profiler.h"
+#include "Rollback.h"
+#include "Rules.h"
+#include "SharedState.h"
+#include "Solver.h"
+#include "Spectator.h"
+#include "Terminal.h"
+#include "TetrisEnv.h"
+#include "Threads.h"
+#include "Wall.h"
 
 using namespace std;
 
@@ -20,30 +36,16 @@ using namespace std;
 // define custom vertex format
 #define CUSTOMFVF (D3DFVF_XYZ | D3DFVF_NORMAL| D3DFVF_DIFFUSE) 
 
-// falling block height/width/size declarations
-#define TILESIZE 2
-#define MAPHEIGHT 20
-#define MAPWIDTH 10
-#define TILEBLACK 0
-#define TILENODRAW 1
-#define TILEBLUE 2
-#define TILEGREEN 3
-#define TILERED 4
-#define TILEYELLOW 5
-#define TILEORANGE 6
-#define TILEPURPLE 7
-#define TILEGREY 8
-#define TILEAQUA 9
+// most cubes drawn in one frame: piece, preview, map and the three borders
+#define MAXINSTANCES (16 + 16 + MAPWIDTH * (MAPHEIGHT + 1) + 2 * (MAPHEIGHT + 1) + MAPWIDTH + 2)
 
 // text justification defines
 #define LEFT 1
 #define CENTER 2
 #define RIGHT 3
 
-int map[MAPWIDTH][MAPHEIGHT + 1];
-DWORD startTime;
-bool gameStarted = false;
-bool danger = false;
+GameState game; // the game being played
+DWORD startTime; // time of the last gravity step
 
 //Global Direct3D Declarations
 LPDIRECT3D9 d3d; //long pointer to direct3d interface
@@ -51,6 +53,31 @@ LPDIRECT3DDEVICE9 d3ddev; //long pointer to device
 LPDIRECT3DVERTEXBUFFER9 v_buffer[8];    // the pointer to the vertex buffer
 LPDIRECT3DINDEXBUFFER9 i_buffer = NULL;
 LPD3DXFONT m_font = NULL;
+LPDIRECT3DSURFACE9 captureSurface = NULL; // system memory copy of the back buffer for frame capture
+wchar_t captureReport[160]; // how the last recording ended, on screen for a few seconds
+DWORD captureReportTime;
+
+//metric ids, see init_metrics
+int frameTimeMetric, tickTimeMetric, inputLatencyMetric, piecesMetric, linesMetric;
+double inputStart = 0.0; // when the oldest input not yet on screen arrived, 0 if none
+
+//current piece for the analytics log, see game_locked
+double pieceStart = 0.0; // when it spawned
+int pieceInputs = 0; // game keys pressed since
+
+//per frame cube instances, built in one pass by build_instances
+D3DXMATRIXA16 instWorld[MAXINSTANCES]; // world transform of each cube
+int instTile[MAXINSTANCES]; // tile colour of each cube
+int instCount = 0;
+
+//-wall N: N games played by a random bot, drawn together by draw_wall
+GameState *wallGames = NULL;
+const GameState **wallBoards = NULL; // wallGames as draw_wall takes them
+int wallCount = 0;
+Wall *wall = NULL; // builds the wall's cubes on every core
+LPDIRECT3DVERTEXBUFFER9 wallVertices = NULL; // every wall cube of the frame, refilled each frame
+LPDIRECT3DINDEXBUFFER9 wallIndices = NULL; // the cube triangles of one batch
+int wallCapacity = 0; // cubes wallVertices holds
 
 //D3D function prototypes
 void initD3D(HWND hWnd); //sets up D3d
@@ -59,17 +86,20 @@ void cleanD3D(void); //closes Direct3D to release memory
 void init_light(void);
 void init_graphics(void); //initializes vertices and creates v_buffer
 void display_text(wchar_t *disText, LONG rctLeft, LONG rctRight, LONG rctTop, LONG rctBottom, int justification); //displays given text to screen
-void init_game(void); //create new game
-void create_block(void); //create new block of struct piece
-void move_block(int x, int y); // move the current block
-int check_collision(int x, int y); // check if current block will collide with others (helper to move)
 void game_timer(void); //advance block every 1 sec
+void fall_block(void); //moves the block down a row
+void game_locked(const GameState *g, const Piece *locked, int lines); //lock hook while analytics runs, adds the player's timing and inputs
 void draw_blocks(void); //draws moving block and locked blocks
+void build_instances(const D3DXMATRIX *matRotate); //fills instWorld/instTile with every cube to draw
+int draw_wall(const GameState *const *games, int count); //draws count boards in a grid in a few batched draws, returns the draws
+void wall_timer(void); //steps every wall game, restarting those that end
 void create_vertices(int r, int g, int b, int vBufferIndex); //creates different colored vertices for drawing our blocks
-void rotate_block(void); //rotates block
-void remove_row(int row); //removes row
-void game_over(); // displays game over message
 wchar_t* score_display(wchar_t* text); //adds current score to text
+void capture_frame(void); //hands the finished back buffer to the capture encoders
+void toggle_capture(int format); //starts or stops recording to capture.y4m / capture000000.png...
+void end_capture(const wchar_t *how); //stops recording and reports it in the debugger and on screen
+void capture_status(void); //draws the recording's progress over the frame, after it was copied
+void init_metrics(LPSTR cmdLine); //registers metrics, -metrics-port N serves them, -metrics-file path snapshots them
 
 // the WindowProc function prototype
 LRESULT CALLBACK WindowProc(HWND hWnd,
@@ -79,10 +109,6 @@ LRESULT CALLBACK WindowProc(HWND hWnd,
 
 struct CUSTOMVERTEX {FLOAT X, Y, Z; D3DVECTOR normal; DWORD color;};   //create custom vertex struct
 
-struct Piece { int size[4][4], x , y; }; // represents a tetris piece
-Piece piece; // current piece being moved
-Piece prePiece; // preview of next piece
-
 // this function initializes and prepares Direct3D for use
 void initD3D(HWND hWnd)
 {
@@ -149,14 +175,8 @@ void init_light(void)
 void init_graphics(void)
 {
 	//different coloured vertices
-	create_vertices(10,10,255,TILEBLUE - 2);
-	create_vertices(10,255,10,TILEGREEN - 2);
-	create_vertices(255,10,10,TILERED - 2);
-	create_vertices(255,255,10,TILEYELLOW - 2);
-	create_vertices(255,150,10,TILEORANGE - 2);
-	create_vertices(255,10,255,TILEPURPLE - 2);
-	create_vertices(140,140,140,TILEGREY - 2);
-	create_vertices(90,255,255,TILEAQUA - 2);
+	for(int tile = TILEBLUE; tile <= TILEAQUA; tile++)
+		create_vertices(tileColors[tile][0], tileColors[tile][1], tileColors[tile][2], tile - 2);
 
 	// create the indices using an int array
 	short indices[] =
@@ -241,474 +261,1126 @@ void create_vertices(int r, int g, int b, int vBufferIndex)
     v_buffer[vBufferIndex]->Unlock();    // unlock the vertex buffer
 }
 
-void init_game(void)
+void game_timer(void)
 {
-	startTime = GetTickCount();
-	gameStarted = false;
-
-	//initialize map to all black
-	for(int x = 0; x < MAPWIDTH; x++)
+	static int lastPieces = 0, lastLines = 0;
+	static double lastTick = 0.0;
+	double now = time_usec();
+
+	//gravity runs off its own clock, but game.tick still counts TICKRATE ticks of play
+	//so shared state and the analytics log see the same clock as step_game games
+	if(!game.gameStarted || lastTick == 0.0)
+		lastTick = now;
+	for(; now - lastTick >= 1e6 / TICKRATE; lastTick += 1e6 / TICKRATE)
+		game.tick++;
+
+	if(game.gameStarted)
 	{
-		for(int y = 0; y < MAPHEIGHT + 1; y++)
+		if(GetTickCount() - startTime > 1000)
 		{
-			if(y == MAPHEIGHT)
-				map[x][y] = TILEGREY;
-			else
-				map[x][y] = TILEBLACK;
+			double tickStart = time_usec();
+			fall_block();
+			metric_observe(tickTimeMetric, time_usec() - tickStart);
+			startTime = GetTickCount();
 		}
 	}
 
-	create_block();
+	//the counters follow the state, whether gravity or a key locked the piece
+	metric_add(piecesMetric, game.pieces - lastPieces);
+	metric_add(linesMetric, game.lines - lastLines);
+	lastPieces = game.pieces;
+	lastLines = game.lines;
 }
 
-void create_block(void)
+void fall_block(void)
 {
-	int randBlock;
-	int i,j;
+	move_block(&game,0,1);
+}
 
-	srand(GetTickCount());
+void game_locked(const GameState *g, const Piece *locked, int lines)
+{
+	AnalyticsEvent e;
 
-	//clear the piece
-	for(i = 0; i < 4; ++i)
+	analytics_lock(&e, g, locked, lines);
+	if(g == &game)
 	{
-		for(j=0; j < 4; ++j)
-			piece.size[i][j] = TILENODRAW;
+		e.placeUsec = (unsigned int)(time_usec() - pieceStart);
+		e.inputs = (unsigned char)(pieceInputs < 255 ? pieceInputs : 255);
+		pieceStart = time_usec();
+		pieceInputs = 0;
 	}
+	analytics_record(&e);
+}
 
-	piece.x = MAPWIDTH/2 - 2;
-	piece.y = 0;
-	
-	//case for if we need to generate preview and current piece
-	if(gameStarted == false)
-	{
-		//get random num for type of block
-		randBlock = rand() % 7;
-		gameStarted = true;
+// this is the function used to render a single frame
+void render_frame(void)
+{
+	static double lastFrame = 0.0;
+	double frameStart = time_usec();
 
-		// have 7 different types of blocks: tower(red),box(blue),pyramid(green),
-		// leftlean(yellow),rightlean(orange),leftknight(purple),rightknight(silver)
-		switch(randBlock)
-		{
-		case 0: //Tower
-			piece.size[1][0] = TILERED;
-			piece.size[1][1] = TILERED;
-			piece.size[1][2] = TILERED;
-			piece.size[1][3] = TILERED;
-			break;
-		case 1: //BOX
-			piece.size[1][1] = TILEBLUE;
-			piece.size[2][1] = TILEBLUE;
-			piece.size[1][2] = TILEBLUE;
-			piece.size[2][2] = TILEBLUE;
-			break;
-		case 2: //Pyramid
-			piece.size[1][1] = TILEGREEN;
-			piece.size[1][2] = TILEGREEN;
-			piece.size[0][2] = TILEGREEN;
-			piece.size[2][2] = TILEGREEN;
-			break;
-		case 3: //Left Lean
-			piece.size[1][1] = TILEYELLOW;
-			piece.size[2][1] = TILEYELLOW;
-			piece.size[2][2] = TILEYELLOW;
-			piece.size[3][2] = TILEYELLOW;
-			break;
-		case 4: //Right Lean
-			piece.size[2][1] = TILEORANGE;
-			piece.size[3][1] = TILEORANGE;
-			piece.size[1][2] = TILEORANGE;
-			piece.size[2][2] = TILEORANGE;
-			break;
-		case 5: //Left Knight
-			piece.size[1][1] = TILEPURPLE;
-			piece.size[2][1] = TILEPURPLE;
-			piece.size[2][2] = TILEPURPLE;
-			piece.size[2][3] = TILEPURPLE;
-			break;
-		case 6: //Right Knight
-			piece.size[2][1] = TILEAQUA;
-			piece.size[1][1] = TILEAQUA;
-			piece.size[1][2] = TILEAQUA;
-			piece.size[1][3] = TILEAQUA;
-			break;
-		}
-	}
+	if(lastFrame != 0.0)
+		metric_observe(frameTimeMetric, frameStart - lastFrame);
+	lastFrame = frameStart;
+
+    // clear the window to black, clear zbuffer
+    d3ddev->Clear(0, NULL, D3DCLEAR_TARGET, D3DCOLOR_XRGB(0, 0, 0), 1.0f, 0);
+	d3ddev->Clear(0, NULL, D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 0), 1.0f, 0);
+
+    d3ddev->BeginScene();    // begins the 3D scene
+
+    // select which vertex format we are using
+    d3ddev->SetFVF(CUSTOMFVF);
+
+	// SET UP THE PIPELINE
+    D3DXMATRIX matView;    // the view transform matrix
+
+    D3DXMatrixLookAtLH(&matView,
+                       &D3DXVECTOR3 ((FLOAT) (TILESIZE * (MAPWIDTH/2 + 2)), 75.0f, (FLOAT)(-MAPHEIGHT)),    // the camera position
+					   &D3DXVECTOR3 ((FLOAT) (TILESIZE * (MAPWIDTH/2 + 2)), 0.0f, (FLOAT) (-MAPHEIGHT)),    // the look-at position
+                       &D3DXVECTOR3 (0.0f, 0.0f, 1.0f));    // the up direction
+
+    d3ddev->SetTransform(D3DTS_VIEW, &matView);    // set the view transform to matView
+
+    D3DXMATRIX matProjection;     // the projection transform matrix
+
+    D3DXMatrixPerspectiveFovLH(&matProjection,
+                               D3DXToRadian(45),    // the horizontal field of view
+                               (FLOAT) SCREEN_WIDTH / (FLOAT)SCREEN_HEIGHT, // aspect ratio
+                               1.0f,    // the near view-plane
+                               300.0f);    // the far view-plane
+
+    d3ddev->SetTransform(D3DTS_PROJECTION, &matProjection);    // set the projection
+ 
+	if(wallCount)
+		draw_wall(wallBoards, wallCount);
 	else
 	{
-		for(i = 0; i < 4; ++i)
-			for(j = 0; j < 4; ++j)
-				piece.size[i][j] = prePiece.size[i][j];
+		draw_blocks();
+
+		display_text(score_display(L"Score:"), 2, 300, 10, 30, LEFT);
+
+		if(!game.gameStarted)
+			display_text(L"Game Over!", 0, SCREEN_WIDTH, SCREEN_HEIGHT/2, SCREEN_HEIGHT, CENTER);
+		else
+			display_text(L"Next Piece", SCREEN_WIDTH/2 + 70, SCREEN_WIDTH, SCREEN_HEIGHT/2 + 100, SCREEN_HEIGHT, CENTER);
 	}
 
-	// NOW we create the preview piece!
+    d3ddev->EndScene();    // ends the 3D scene
+
+	capture_frame();
+	capture_status();
+
+    d3ddev->Present(NULL, NULL, NULL, NULL);    // displays the created frame
 
-	//clear the preview prePiece
-	for(i = 0; i < 4; ++i)
+	if(inputStart != 0.0)
 	{
-		for(j=0; j < 4; ++j)
-			prePiece.size[i][j] = TILENODRAW;
+		metric_observe(inputLatencyMetric, time_usec() - inputStart);
+		inputStart = 0.0;
 	}
+}
+
+wchar_t* score_display(wchar_t* text)
+{
+	if(game.gameStarted)
+		game.score++;
+	wchar_t istr[32];
+	_itow_s(game.score,istr,10);
+	wchar_t *disText = (wchar_t*) malloc(60 * sizeof(wchar_t));
+	wcscpy(disText, text);
+	wcscat(disText,istr);
+
+	return disText;
+}
+
+// appends one cube to the instance arrays. Every cube shares the rotation, so
+// rotation * translation is just the rotation rows with the translation as the last row
+inline void push_instance(const __m128 rot[3], int tileX, int tileY, int tile)
+{
+	float *m = (float*) &instWorld[instCount];
+
+	_mm_store_ps(m, rot[0]);
+	_mm_store_ps(m + 4, rot[1]);
+	_mm_store_ps(m + 8, rot[2]);
+	_mm_store_ps(m + 12, _mm_set_ps(1.0f, (FLOAT)(TILESIZE * -tileY), 0.0f, (FLOAT)(TILESIZE * tileX)));
+	instTile[instCount++] = tile;
+}
+
+void build_instances(const D3DXMATRIX *matRotate)
+{
+	PROFILE_SCOPE(PROFILE_INSTANCES);
+	__m128 rot[3];
+	int i,j;
+
+	rot[0] = _mm_loadu_ps(&matRotate->_11);
+	rot[1] = _mm_loadu_ps(&matRotate->_21);
+	rot[2] = _mm_loadu_ps(&matRotate->_31);
+	instCount = 0;
+
+	//current block that is moving
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(game.piece.size[i][j] != TILENODRAW)
+				push_instance(rot, game.piece.x + i, game.piece.y + j, game.piece.size[i][j]);
+
+	//preview block
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(game.prePiece.size[i][j] != TILENODRAW)
+				push_instance(rot, game.prePiece.x + i, game.prePiece.y + j, game.prePiece.size[i][j]);
+
+	//map
+	for(i = 0; i < MAPWIDTH; i++)
+		for(j = 0; j < MAPHEIGHT + 1; j++)
+			if(game.map[i][j] != TILEBLACK)
+				push_instance(rot, i, j, game.map[i][j]);
+
+	//left border
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		push_instance(rot, -1, j, TILEGREY);
+	//top border
+	for(i = -1; i < MAPWIDTH + 1; i++)
+		push_instance(rot, i, -1, TILEGREY);
+	//right border
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		push_instance(rot, MAPWIDTH, j, TILEGREY);
+}
 
-	prePiece.x = MAPWIDTH + 2;
-	prePiece.y = MAPHEIGHT - 4;
+void draw_blocks(void)
+{
+	D3DXMATRIX matRotateZ;
+	int i, lastTile = -1;
+	static FLOAT rot = 0.0f; rot+=0.025f;
+	if(rot >= 360.0f)
+		rot = 0.0f;
+
+	// select the vertex and index buffer to display
+	d3ddev->SetIndices(i_buffer);
 	
-	//get random num for type of block
-	randBlock = rand() % 7;
-
-	// have 7 different types of blocks: tower(red),box(blue),pyramid(green),
-	// leftlean(yellow),rightlean(orange),leftknight(pink),rightknight(silver)
-	switch(randBlock)
-	{
-		case 0: //Tower
-			prePiece.size[1][0] = TILERED;
-			prePiece.size[1][1] = TILERED;
-			prePiece.size[1][2] = TILERED;
-			prePiece.size[1][3] = TILERED;
-			break;
-		case 1: //BOX
-			prePiece.size[1][1] = TILEBLUE;
-			prePiece.size[2][1] = TILEBLUE;
-			prePiece.size[1][2] = TILEBLUE;
-			prePiece.size[2][2] = TILEBLUE;
-			break;
-		case 2: //Pyramid
-			prePiece.size[1][1] = TILEGREEN;
-			prePiece.size[1][2] = TILEGREEN;
-			prePiece.size[0][2] = TILEGREEN;
-			prePiece.size[2][2] = TILEGREEN;
-			break;
-		case 3: //Left Lean
-			prePiece.size[1][1] = TILEYELLOW;
-			prePiece.size[2][1] = TILEYELLOW;
-			prePiece.size[2][2] = TILEYELLOW;
-			prePiece.size[3][2] = TILEYELLOW;
-			break;
-		case 4: //Right Lean
-			prePiece.size[2][1] = TILEORANGE;
-			prePiece.size[3][1] = TILEORANGE;
-			prePiece.size[1][2] = TILEORANGE;
-			prePiece.size[2][2] = TILEORANGE;
-			break;
-		case 5: //Left Knight
-			prePiece.size[1][1] = TILEPURPLE;
-			prePiece.size[2][1] = TILEPURPLE;
-			prePiece.size[2][2] = TILEPURPLE;
-			prePiece.size[2][3] = TILEPURPLE;
-			break;
-		case 6: //Right Knight
-			prePiece.size[2][1] = TILEAQUA;
-			prePiece.size[1][1] = TILEAQUA;
-			prePiece.size[1][2] = TILEAQUA;
-			prePiece.size[1][3] = TILEAQUA;
-			break;
+	if(game.danger)
+		D3DXMatrixRotationZ(&matRotateZ,rot);
+	else
+		D3DXMatrixRotationZ(&matRotateZ,0.0f);
+
+	build_instances(&matRotateZ);
+
+	for(i = 0; i < instCount; i++)
+	{
+		//only switch vertex buffers when the colour changes
+		if(instTile[i] != lastTile)
+		{
+			lastTile = instTile[i];
+			d3ddev->SetStreamSource(0, v_buffer[lastTile - 2], 0, sizeof(CUSTOMVERTEX));
+		}
+		d3ddev->SetTransform(D3DTS_WORLD, &instWorld[i]);
+		d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
 	}
 }
 
-void move_block(int x, int y)
+int draw_wall(const GameState *const *games, int count)
 {
-	//if there is a collision
-	if(check_collision(x,y))
+	static WallView views[WALL_MAXBOARDS];
+	static FLOAT rot = 0.0f;
+	D3DXMATRIX matView, matProjection, matWorld;
+	WallCamera camera;
+	WallVertex *vertices;
+	int cubes, draws = 0;
+
+	rot += 0.025f;
+	if(rot >= 360.0f)
+		rot = 0.0f;
+	if(count > WALL_MAXBOARDS)
+		count = WALL_MAXBOARDS;
+	if(!wall)
+		wall = wall_create(0);
+	if(!wall || count <= 0)
+		return 0;
+
+	if(!wallIndices)
 	{
-		//if we were moving down
-		if(y > 0)
+		unsigned short *indices;
+
+		if(FAILED(d3ddev->CreateIndexBuffer(WALL_BATCHCUBES * WALL_CUBEINDICES * sizeof(short), D3DUSAGE_WRITEONLY,
+			D3DFMT_INDEX16, D3DPOOL_MANAGED, &wallIndices, NULL)))
+			return 0;
+		if(FAILED(wallIndices->Lock(0, 0, (void**)&indices, 0)))
 		{
-			//if at top of the screen
-			if(piece.y < 1)
-			{
-				game_over();
-			}
-			else // add this to the map
-			{
-				if(piece.y < 5)
-					danger = true;
-				int i,j;
+			wallIndices->Release();
+			wallIndices = NULL;
+			return 0;
+		}
+		wall_indices(indices);
+		wallIndices->Unlock();
+	}
 
-				for(i = 0; i < 4; ++i)
-				{
-					for(j = 0; j < 4; ++j)
-					{
-						if(piece.size[i][j] != TILENODRAW)
-						{
-							map[piece.x + i][piece.y + j] = piece.size[i][j];
-						}
-					}
-				}
+	//one dynamic buffer for the whole wall, grown to the most boards could need
+	cubes = wall_count(wall, games, count);
+	if(cubes > wallCapacity)
+	{
+		if(wallVertices)
+			wallVertices->Release();
+		wallVertices = NULL;
+		wallCapacity = 0;
+		if(FAILED(d3ddev->CreateVertexBuffer(count * WALL_BOARDCUBES * WALL_CUBEVERTICES * sizeof(CUSTOMVERTEX),
+			D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, CUSTOMFVF, D3DPOOL_DEFAULT, &wallVertices, NULL)))
+			return 0;
+		wallCapacity = count * WALL_BOARDCUBES;
+	}
 
-				// perhaps a row has been cleared?
-				for(j = 0; j < MAPHEIGHT; j++)
-				{
-					bool filled = true;
-					for(i = 0; i < MAPWIDTH; i++)
-					{
-						if(map[i][j] == TILEBLACK)
-						{
-							filled = false;
-							break;
-						}
-					}
+	if(FAILED(wallVertices->Lock(0, cubes * WALL_CUBEVERTICES * sizeof(CUSTOMVERTEX), (void**)&vertices, D3DLOCK_DISCARD)))
+		return 0; // e.g. the device is lost, the wall is skipped this frame
+	wall_layout(count, (FLOAT)SCREEN_WIDTH / (FLOAT)SCREEN_HEIGHT, D3DXToRadian(45), views, &camera);
+	wall_build(wall, games, views, count, rot, vertices);
+	wallVertices->Unlock();
+
+	//one camera over the whole grid, the cubes are already in place
+	D3DXMatrixLookAtLH(&matView,
+					   &D3DXVECTOR3 (camera.x, camera.height, camera.z),    // the camera position
+					   &D3DXVECTOR3 (camera.x, 0.0f, camera.z),    // the look-at position
+					   &D3DXVECTOR3 (0.0f, 0.0f, 1.0f));    // the up direction
+	d3ddev->SetTransform(D3DTS_VIEW, &matView);
+	D3DXMatrixPerspectiveFovLH(&matProjection, D3DXToRadian(45), (FLOAT) SCREEN_WIDTH / (FLOAT)SCREEN_HEIGHT,
+		1.0f, camera.height + 10.0f);
+	d3ddev->SetTransform(D3DTS_PROJECTION, &matProjection);
+	D3DXMatrixIdentity(&matWorld);
+	d3ddev->SetTransform(D3DTS_WORLD, &matWorld);
+
+	d3ddev->SetStreamSource(0, wallVertices, 0, sizeof(CUSTOMVERTEX));
+	d3ddev->SetIndices(wallIndices);
+	for(int first = 0; first < cubes; first += WALL_BATCHCUBES)
+	{
+		int n = cubes - first < WALL_BATCHCUBES ? cubes - first : WALL_BATCHCUBES;
 
-					if(filled)
-					{
-						remove_row(j);
-					}
+		d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, first * WALL_CUBEVERTICES, 0, n * WALL_CUBEVERTICES, 0, n * 12);
+		draws++;
+	}
+	return draws;
+}
 
-				}
-				create_block();
-			}
+void wall_timer(void)
+{
+	static double lastTick = 0.0;
+	static unsigned int random = 1;
+	double now = time_usec();
+
+	if(lastTick == 0.0)
+		lastTick = now;
+	for(; now - lastTick >= 1e6 / TICKRATE; lastTick += 1e6 / TICKRATE)
+		for(int i = 0; i < wallCount; i++)
+		{
+			random = random * 214013 + 2531011;
+			step_game(&wallGames[i], (random >> 16) % 5 == 0 ? 1 << ((random >> 20) % 4) : 0);
+			if(!wallGames[i].gameStarted)
+				init_game(&wallGames[i], random);
 		}
-	}
-	else
-	{
-		piece.x+=x;
-		piece.y+=y;
-	}
 }
 
-void game_over(void)
+#ifdef TETRIS_BENCHMARK
+// runs one benchmark. With TETRIS_PROFILE its per operation averages follow its own output
+void run_benchmark(void (*benchmark)(void))
 {
-	gameStarted = false;
+	LockHook hook = set_lock_hook(NULL); // benchmark games stay out of an -analytics log
+#ifdef TETRIS_PROFILE
+	static char text[2048];
+
+	profile_start();
+#endif
+	benchmark();
+#ifdef TETRIS_PROFILE
+	profile_stop();
+	profile_report(text, sizeof(text));
+	OutputDebugStringA(text);
+#endif
+	set_lock_hook(hook);
 }
 
-void remove_row(int row)
+// one cube the old way, a D3DX translation and a full matrix multiply
+static void push_scalar(const D3DXMATRIX *matRotate, int tileX, int tileY, D3DXMATRIX *world, int *count)
 {
-	int x,y;
+	D3DXMATRIX matTranslate;
 
-	for(x = 0; x < MAPWIDTH; x++)
-	{
-		for(y = row; y > 0; y--)
-		{
-			map[x][y] = map[x][y - 1];
-			if(y == 5)
-				if(map[x][y] == TILEBLACK)
-					danger = false;
-		}
-	}
+	D3DXMatrixTranslation(&matTranslate, (FLOAT)(TILESIZE * tileX), 0.0f, (FLOAT)-(TILESIZE * tileY));
+	world[(*count)++] = *matRotate * matTranslate;
 }
 
-void rotate_block(void)
+// the same cubes as build_instances in the same order, each done with push_scalar
+static int scalar_instances(const D3DXMATRIX *matRotate, D3DXMATRIX *world)
 {
-	int i, j, temp[4][4];
+	int i, j, count = 0;
 
-	//copy &rotate the piece to the temporary array
-	for(i=0; i<4; i++)
-		for(j=0; j<4; j++)
-			temp[3-j][ i ]=piece.size[ i ][j];
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(game.piece.size[i][j] != TILENODRAW)
+				push_scalar(matRotate, game.piece.x + i, game.piece.y + j, world, &count);
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(game.prePiece.size[i][j] != TILENODRAW)
+				push_scalar(matRotate, game.prePiece.x + i, game.prePiece.y + j, world, &count);
+	for(i = 0; i < MAPWIDTH; i++)
+		for(j = 0; j < MAPHEIGHT + 1; j++)
+			if(game.map[i][j] != TILEBLACK)
+				push_scalar(matRotate, i, j, world, &count);
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		push_scalar(matRotate, -1, j, world, &count);
+	for(i = -1; i < MAPWIDTH + 1; i++)
+		push_scalar(matRotate, i, -1, world, &count);
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		push_scalar(matRotate, MAPWIDTH, j, world, &count);
+	return count;
+}
 
-	//check collision of the temporary array with map borders
-	for(i=0; i<4; i++)
-		for(j=0; j<4; j++)
-			if(temp[ i ][j] != TILENODRAW)
-				if(piece.x + i < 0 || piece.x + i > MAPWIDTH - 1 ||
-					piece.y + j < 0 || piece.y + j > MAPHEIGHT - 1)
-					return;
+// times the old per cube D3DX multiply against build_instances on a full
+// board, both over every cube of the frame: pieces, map and borders
+void benchmark_transforms(void)
+{
+	static D3DXMATRIX scalarWorld[MAXINSTANCES];
+	LARGE_INTEGER freq, start, end;
+	D3DXMATRIX matRotateZ;
+	const int iterations = 10000;
+	double scalarTime, batchTime;
+	int n, i, j, scalarCount = 0;
+	GameState saved = game;
+	volatile FLOAT sink = 0.0f;
+	wchar_t msg[256];
 
-	//check collision of the temporary array with the blocks on the map
-	for(int x=0; x< MAPWIDTH; x++)
-		for(int y=0; y< MAPHEIGHT; y++)
-			if(x >= piece.x && x < piece.x + 4)
-				if(y >= piece.y && y < piece.y +4)
-					if(map[x][y] != TILEBLACK)
-						if(temp[x - piece.x][y - piece.y] != TILENODRAW)
-							return;
+	for(i = 0; i < MAPWIDTH; i++)
+		for(j = 0; j < MAPHEIGHT; j++)
+			game.map[i][j] = TILEBLUE + (i + j) % 8;
 
-	//end collision check
+	D3DXMatrixRotationZ(&matRotateZ, 0.5f);
+	QueryPerformanceFrequency(&freq);
 
-	//successful!  copy the rotated temporary array to the original piece
-	for(i=0; i<4; i++)
-		for(j=0; j<4; j++)
-			piece.size[ i ][j]=temp[ i ][j];
+	QueryPerformanceCounter(&start);
+	for(n = 0; n < iterations; n++)
+	{
+		scalarCount = scalar_instances(&matRotateZ, scalarWorld);
+		sink += scalarWorld[scalarCount - 1]._41;
+	}
+	QueryPerformanceCounter(&end);
+	scalarTime = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+
+	QueryPerformanceCounter(&start);
+	for(n = 0; n < iterations; n++)
+	{
+		build_instances(&matRotateZ);
+		sink += instWorld[instCount - 1]._41;
+	}
+	QueryPerformanceCounter(&end);
+	batchTime = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+
+	game = saved;
+
+	swprintf_s(msg, L"transforms: scalar %.1f ns/frame, batched %.1f ns/frame, %.2fx, %d cubes each%s\n",
+		scalarTime * 1e9 / iterations, batchTime * 1e9 / iterations, batchTime > 0.0 ? scalarTime / batchTime : 0.0,
+		instCount, scalarCount == instCount ? L"" : L" MISMATCH");
+	OutputDebugString(msg);
 }
 
-//check if piece moved by x and y if it will collide with walls or other blocks
-int check_collision(int nx, int ny)
+// delivers 10 late remote inputs that all differ from the prediction and times
+// the advance that rewinds and resimulates them
+void benchmark_rollback(void)
 {
-	int nextx = piece.x + nx;
-	int nexty = piece.y + ny;
-	int i,j,x,y;
+	static RollbackSession session;
+	LARGE_INTEGER freq, start, end;
+	const int iterations = 1000;
+	double total = 0.0;
+	int n, i, first, input;
+	wchar_t msg[128];
 
-	//walls checking for each part of the piece that is filled in
-	for(i = 0; i < 4; i++)
+	rollback_start(&session, 0, 1);
+	QueryPerformanceFrequency(&freq);
+
+	for(n = 0; n < iterations; n++)
 	{
-		for(j = 0; j < 4; j++)
-		{
-			if(piece.size[i][j] != TILENODRAW)
-				if(nextx + i < 0 || nextx + i > MAPWIDTH - 1 || 
-						nexty + j < 0 || nexty + j > MAPHEIGHT - 1)
-						return 1;
-		}
+		input = (n & 1) ? INPUT_LEFT : INPUT_RIGHT; // never what was predicted
+		first = session.tick;
+		for(i = 0; i < 10; i++)
+			rollback_advance(&session, INPUT_ROTATE);
+		for(i = 0; i < 10; i++)
+			rollback_remote_input(&session, first + i, input);
+
+		QueryPerformanceCounter(&start);
+		rollback_advance(&session, INPUT_ROTATE);
+		QueryPerformanceCounter(&end);
+		total += (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+
+		rollback_remote_input(&session, first + 10, input);
 	}
 
-	//check if it will collide with other blocks
-	for(x=0; x< MAPWIDTH; x++)
-		for(y=0; y< MAPHEIGHT; y++)
-			if(x >= nextx && x < nextx + 4)
-				if(y >= nexty && y < nexty +4)
-					if(map[x][y] != TILEBLACK)
-						if(piece.size[x - nextx][y - nexty] != TILENODRAW)
-							return 1;
+	swprintf_s(msg, L"rollback: %.2f us to resimulate 10 ticks (%d rollbacks)\n",
+		total * 1e6 / iterations, session.rollbacks);
+	OutputDebugString(msg);
+}
 
-	return 0;
+// input a scripted player sends on a tick, the same on both ends of a match
+static int scripted_input(int player, int tick)
+{
+	unsigned int h = (unsigned int)tick * 2654435761u ^ (unsigned int)player * 40503u;
+
+	h ^= h >> 13;
+	return h % 7 == 0 ? 1 << (h % 4) : 0;
 }
 
-void game_timer(void)
+// two sessions over loopback UDP with 40 ms latency, 10 ms jitter and 10% loss
+// each way play scripted inputs, with a 250 ms outage both ways at tick 300 so
+// far more sends are lost in a row than one packet's inputs cover; both must
+// confirm the same hash for every tick
+void benchmark_rollback_network(void)
 {
-	if(gameStarted)
+	static RollbackSession sessions[2];
+	UdpTransport transports[2];
+	const int ticks = 1000, outageTick = 300;
+	int p, checkTick = 0, checked = 0, mismatched = 0;
+	bool outage = false;
+	double start = time_usec();
+	wchar_t msg[192];
+
+	rollback_start(&sessions[0], 0, 42);
+	rollback_start(&sessions[1], 1, 42);
+	if(!udp_open(&transports[0], 27101, "127.0.0.1", 27102))
+		return;
+	if(!udp_open(&transports[1], 27102, "127.0.0.1", 27101))
 	{
-		if(GetTickCount() - startTime > 1000)
+		udp_close(&transports[0]);
+		return;
+	}
+	for(p = 0; p < 2; p++)
+		udp_simulate(&transports[p], 40, 10, 10);
+
+	//play, then idle on until every input has reached both sides
+	while((sessions[0].hashedTick < ticks || sessions[1].hashedTick < ticks) && time_usec() - start < 60e6)
+	{
+		if(!outage && sessions[0].tick >= outageTick)
 		{
-			move_block(0,1);
-			startTime = GetTickCount();
+			for(p = 0; p < 2; p++)
+				udp_outage(&transports[p], 250);
+			outage = true;
+		}
+		for(p = 0; p < 2; p++)
+		{
+			RollbackSession *s = &sessions[p];
+
+			rollback_advance(s, s->tick < ticks ? scripted_input(p, s->tick) : 0);
+			rollback_send(s, &transports[p]);
+		}
+		sleep_msec(1);
+		for(p = 0; p < 2; p++)
+			rollback_receive(&sessions[p], &transports[p]);
+
+		//every tick both sides have confirmed, while it is still in both rings
+		for(; checkTick < ticks && checkTick < sessions[0].hashedTick && checkTick < sessions[1].hashedTick; checkTick++)
+		{
+			int slot = checkTick % ROLLBACK_INPUTS;
+
+			if(sessions[0].confirmedHashTicks[slot] != checkTick || sessions[1].confirmedHashTicks[slot] != checkTick)
+				continue;
+			checked++;
+			if(sessions[0].confirmedHashes[slot] != sessions[1].confirmedHashes[slot])
+				mismatched++;
 		}
 	}
+	udp_close(&transports[0]);
+	udp_close(&transports[1]);
+
+	swprintf_s(msg, L"rollback network: 40 ms, 10%% loss, 250 ms outage, %d of %d ticks compared, %d mismatched, %d+%d rollbacks, %s\n",
+		checked, ticks, mismatched, sessions[0].rollbacks, sessions[1].rollbacks,
+		sessions[0].desynced || sessions[1].desynced || mismatched || checkTick < ticks ? L"FAILED" : L"converged");
+	OutputDebugString(msg);
 }
 
-// this is the function used to render a single frame
-void render_frame(void)
+// plays a scripted game through the spectator feed with 1000 subscribers draining it
+void benchmark_spectator(void)
 {
-    // clear the window to black, clear zbuffer
-    d3ddev->Clear(0, NULL, D3DCLEAR_TARGET, D3DCOLOR_XRGB(0, 0, 0), 1.0f, 0);
-	d3ddev->Clear(0, NULL, D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 0), 1.0f, 0);
+	static SpectatorFeed feed;
+	static SpectatorSubscriber subscribers[1000];
+	GameState state;
+	SpectatorPacket *packet;
+	LARGE_INTEGER freq, start, end;
+	const int ticks = 10000;
+	unsigned int random = 1;
+	int t, i;
+	wchar_t msg[128];
+
+	spectator_init(&feed);
+	for(i = 0; i < 1000; i++)
+		spectator_subscribe(&feed, &subscribers[i]);
+	init_game(&state, 1);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+	for(t = 0; t < ticks; t++)
+	{
+		random = random * 214013 + 2531011;
+		step_game(&state, (random >> 16) % 5 == 0 ? 1 << ((random >> 20) % 4) : 0);
+		if(!state.gameStarted)
+			init_game(&state, t);
+
+		spectator_publish(&feed, spectator_encode(&feed, &state));
+		for(i = 0; i < 1000; i++)
+			while((packet = spectator_next(&subscribers[i])) != NULL)
+				spectator_release(packet);
+	}
+	QueryPerformanceCounter(&end);
 
-    d3ddev->BeginScene();    // begins the 3D scene
+	swprintf_s(msg, L"spectator: %.2f bytes/tick, %.2f us/tick for 1000 subscribers\n", feed.bytes / feed.packets,
+		(double)(end.QuadPart - start.QuadPart) * 1e6 / freq.QuadPart / ticks);
+	OutputDebugString(msg);
+}
 
-    // select which vertex format we are using
-    d3ddev->SetFVF(CUSTOMFVF);
+// plays the same scripted inputs through step_game, the classic policy
+// instantiation called directly, and every registered variant through its pointer
+void benchmark_rules(void)
+{
+	LARGE_INTEGER freq, start, end;
+	const int ticks = 1000000;
+	const RuleVariant *variants;
+	GameState state;
+	unsigned int random;
+	int count, pass, t;
+	wchar_t msg[128];
+
+	variants = rule_variants(&count);
+	QueryPerformanceFrequency(&freq);
+	for(pass = -2; pass < count; pass++)
+	{
+		const char *name = pass == -2 ? "step_game" : pass == -1 ? "ClassicRules" : variants[pass].name;
+
+		random = 1;
+		if(pass < 0)
+			init_game(&state, 1);
+		else
+			variants[pass].init(&state, 1);
+		QueryPerformanceCounter(&start);
+		for(t = 0; t < ticks; t++)
+		{
+			random = random * 214013 + 2531011;
+			int input = (random >> 16) % 5 == 0 ? 1 << ((random >> 20) % 4) : 0;
 
-	// SET UP THE PIPELINE
-    D3DXMATRIX matView;    // the view transform matrix
+			if(pass == -2)
+				step_game(&state, input);
+			else if(pass == -1)
+				ClassicRules::step(&state, input);
+			else
+				variants[pass].step(&state, input);
+			if(!state.gameStarted)
+			{
+				if(pass < 0)
+					init_game(&state, t);
+				else
+					variants[pass].init(&state, t);
+			}
+		}
+		QueryPerformanceCounter(&end);
 
-    D3DXMatrixLookAtLH(&matView,
-                       &D3DXVECTOR3 ((FLOAT) (TILESIZE * (MAPWIDTH/2 + 2)), 75.0f, (FLOAT)(-MAPHEIGHT)),    // the camera position
-					   &D3DXVECTOR3 ((FLOAT) (TILESIZE * (MAPWIDTH/2 + 2)), 0.0f, (FLOAT) (-MAPHEIGHT)),    // the look-at position
-                       &D3DXVECTOR3 (0.0f, 0.0f, 1.0f));    // the up direction
+		swprintf_s(msg, L"rules: %-12S %.2f ns/tick\n", name,
+			(double)(end.QuadPart - start.QuadPart) * 1e9 / freq.QuadPart / ticks);
+		OutputDebugString(msg);
+	}
+}
 
-    d3ddev->SetTransform(D3DTS_VIEW, &matView);    // set the view transform to matView
+// times analytics_record in bursts the writer keeps up with, then one burst
+// far larger than the ring to show records being dropped instead of waited on
+void benchmark_analytics(void)
+{
+	LARGE_INTEGER freq, start, end;
+	AnalyticsEvent e;
+	AnalyticsStats stats;
+	GameState state;
+	double total = 0.0;
+	int burst, i;
+	wchar_t msg[160];
+
+	init_game(&state, 1);
+	analytics_lock(&e, &state, &state.piece, 0);
+	if(!analytics_start("benchmark", 1 << 20))
+		return;
+
+	QueryPerformanceFrequency(&freq);
+	for(burst = 0; burst < 100; burst++)
+	{
+		QueryPerformanceCounter(&start);
+		for(i = 0; i < 2000; i++)
+		{
+			e.tick++;
+			analytics_record(&e);
+		}
+		QueryPerformanceCounter(&end);
+		total += (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
+		sleep_msec(25);
+	}
+	for(i = 0; i < 1000000; i++)
+		analytics_record(&e);
+
+	analytics_stop();
+	analytics_stats(&stats);
+	swprintf_s(msg, L"analytics: %.1f ns/record, %ld of %ld written to %d files (%.1f bytes/record), %ld dropped\n",
+		total * 1e9 / 200000, stats.written, stats.recorded, stats.files, stats.bytesWritten / stats.written, stats.dropped);
+	OutputDebugString(msg);
+}
 
-    D3DXMATRIX matProjection;     // the projection transform matrix
+static volatile bool sharedBenchmarkDone;
+static double sharedStaleness, sharedMaxStaleness;
+static long sharedSnapshots;
 
-    D3DXMatrixPerspectiveFovLH(&matProjection,
-                               D3DXToRadian(45),    // the horizontal field of view
-                               (FLOAT) SCREEN_WIDTH / (FLOAT)SCREEN_HEIGHT, // aspect ratio
-                               1.0f,    // the near view-plane
-                               300.0f);    // the far view-plane
+// polls the region like an overlay would, timing how old each new snapshot is
+static THREADPROC shared_benchmark_reader(void *arg)
+{
+	SharedReader reader;
+	SharedState snapshot;
+	long last = -1;
 
-    d3ddev->SetTransform(D3DTS_PROJECTION, &matProjection);    // set the projection
- 
-	draw_blocks();
+	if(!shared_attach(&reader, "TetrisGameStateBenchmark"))
+		return 0;
+	while(!sharedBenchmarkDone)
+	{
+		if(shared_read(&reader, &snapshot) && snapshot.sequence != last)
+		{
+			double age = time_usec() - snapshot.publishUsec;
 
-	display_text(score_display(L"Score:"), 2, 300, 10, 30, LEFT);
+			last = snapshot.sequence;
+			sharedStaleness += age;
+			if(age > sharedMaxStaleness)
+				sharedMaxStaleness = age;
+			sharedSnapshots++;
+		}
+	}
+	shared_detach(&reader);
+	return 0;
+}
 
-	if(!gameStarted)
-		display_text(L"Game Over!", 0, SCREEN_WIDTH, SCREEN_HEIGHT/2, SCREEN_HEIGHT, CENTER);
-	else
-		display_text(L"Next Piece", SCREEN_WIDTH/2 + 70, SCREEN_WIDTH, SCREEN_HEIGHT/2 + 100, SCREEN_HEIGHT, CENTER);
+// publish cost in a tight loop, then a reader thread measuring staleness while
+// the game publishes at 1000 Hz
+void benchmark_shared(void)
+{
+	LARGE_INTEGER freq, start, end;
+	GameState state;
+	Thread reader;
+	double publishTime;
+	const int publishes = 100000;
+	int i;
+	wchar_t msg[160];
+
+	if(!shared_open("TetrisGameStateBenchmark"))
+		return;
+	init_game(&state, 1);
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&start);
+	for(i = 0; i < publishes; i++)
+	{
+		state.score = i;
+		shared_publish(&state);
+	}
+	QueryPerformanceCounter(&end);
+	publishTime = (double)(end.QuadPart - start.QuadPart) / freq.QuadPart;
 
-    d3ddev->EndScene();    // ends the 3D scene
+	sharedBenchmarkDone = false;
+	sharedStaleness = sharedMaxStaleness = 0.0;
+	sharedSnapshots = 0;
+	if(thread_create(&reader, shared_benchmark_reader, NULL))
+	{
+		for(i = 0; i < 1000; i++)
+		{
+			state.score++;
+			shared_publish(&state);
+			sleep_msec(1);
+		}
+		sharedBenchmarkDone = true;
+		thread_join(reader);
+	}
+	shared_close();
 
-    d3ddev->Present(NULL, NULL, NULL, NULL);    // displays the created frame
+	swprintf_s(msg, L"shared state: %.1f ns/publish, reader saw %ld snapshots %.1f us old on average, %.1f us at worst\n",
+		publishTime * 1e9 / publishes, sharedSnapshots, sharedStaleness / (sharedSnapshots ? sharedSnapshots : 1), sharedMaxStaleness);
+	OutputDebugString(msg);
 }
 
-wchar_t* score_display(wchar_t* text)
+// perfect clear and line setups, bottom rows drawn top first with # for blocks.
+// The first two types are the current piece and the preview
+struct SolverSetup
 {
-	static int score = 0; 
-	if(gameStarted)
-		score++;
-	wchar_t istr[32];
-	_itow_s(score,istr,10);
-	wchar_t *disText = (wchar_t*) malloc(60 * sizeof(wchar_t));
-	wcscpy(disText, text);
-	wcscat(disText,istr);
+	const char *name;
+	const char *rows[4];
+	int types[11];
+	int maxPieces, targetLines;
+};
 
-	return disText;
+static const SolverSetup solverSetups[] =
+{
+	{ "tower slot", { "###....###" }, { 0, 1, 2 }, 1, 0 },
+	{ "box hole", { "####..####", "####..####" }, { 1, 0, 2 }, 1, 0 },
+	{ "4 towers", { "....######", "....######", "....######", "....######" }, { 0, 0, 0, 0, 1 }, 4, 0 },
+	{ "empty, boxes", { NULL }, { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }, 10, 0 },
+	{ "empty, mixed", { NULL }, { 0, 1, 2, 3, 4, 5, 6, 0, 1, 2, 3 }, 10, 0 },
+	{ "empty, hard", { NULL }, { 2, 5, 6, 3, 4, 0, 1, 2, 5, 6, 3 }, 10, 0 },
+	{ "no solution", { "......####", "......####", "#.....####", "##...#####" }, { 2, 3, 0, 4, 6, 5, 1 }, 7, 0 },
+	{ "2 lines", { NULL }, { 2, 3, 4, 5, 6, 2, 3, 4, 5, 6, 2 }, 6, 2 },
+};
+
+// solves each setup on every core and checks the placements against the real
+// engine: each must fit, rest on the stack, and together give the result
+void benchmark_solver(void)
+{
+	wchar_t msg[200];
+
+	for(int s = 0; s < (int)(sizeof(solverSetups) / sizeof(solverSetups[0])); s++)
+	{
+		const SolverSetup *setup = &solverSetups[s];
+		SolverResult result;
+		GameState state;
+		int rows = 0, lines = 0;
+		bool valid = true;
+
+		init_game(&state, 1);
+		while(rows < 4 && setup->rows[rows])
+			rows++;
+		for(int r = 0; r < rows; r++)
+			for(int x = 0; x < MAPWIDTH; x++)
+				state.map[x][MAPHEIGHT - rows + r] = setup->rows[r][x] == '#' ? TILEGREY : TILEBLACK;
+		make_piece(&state.piece, setup->types[0]);
+		state.piece.x = MAPWIDTH/2 - 2;
+		state.piece.y = 0;
+		make_piece(&state.prePiece, setup->types[1]);
+
+		solve_game(&state, setup->types + 2, 9, setup->maxPieces, setup->targetLines, 0, &result);
+
+		for(int i = 0; i < result.count && valid; i++)
+		{
+			const SolverPlacement *p = &result.placements[i];
+
+			make_piece(&state.piece, p->type);
+			state.piece.x = MAPWIDTH/2 - 2;
+			state.piece.y = 0;
+			for(int turn = 0; turn < 4 && state.piece.rotation != p->rotation; turn++)
+				rotate_block(&state);
+			state.piece.x = p->x;
+			state.piece.y = p->y;
+			valid = !check_collision(&state, 0, 0) && check_collision(&state, 0, 1);
+			lines -= state.lines;
+			lock_block(&state);
+			lines += state.lines;
+		}
+		if(result.found && setup->targetLines == 0)
+			for(int x = 0; x < MAPWIDTH; x++)
+				for(int y = 0; y < MAPHEIGHT; y++)
+					valid = valid && state.map[x][y] == TILEBLACK;
+		if(result.found && setup->targetLines)
+			valid = valid && lines >= setup->targetLines;
+
+		swprintf_s(msg, L"solver: %-14S %s in %d pieces, %.2f ms, %lld nodes, %.0f nodes/s%s\n", setup->name,
+			result.found ? L"solved" : L"no solution", result.count, result.seconds * 1e3, result.nodes,
+			result.nodes / (result.seconds > 0 ? result.seconds : 1), valid ? L"" : L" INVALID");
+		OutputDebugString(msg);
+	}
 }
 
-void draw_blocks(void)
+// perft counts known to be right, bottom rows drawn top first with # for blocks.
+// They were checked against a separate brute force enumerator with its own
+// collision, rotation, lock and row clear written from the rules in Game.cpp.
+// Any change to collision, rotation or line clears that changes them is a rules change
+struct PerftSetup
 {
-	D3DXMATRIX matTranslate;
-	D3DXMATRIX matRotateZ;
-	int i,j;
-	static FLOAT rot = 0.0f; rot+=0.025f;
-	if(rot >= 360.0f)
-		rot = 0.0f;
+	const char *name;
+	const char *rows[4];
+	const char *pieces;
+	int depth;
+	long long paths[4], boards; // counts at depth 1..4, distinct boards at depth 4
+};
+
+static const PerftSetup perftSetups[] =
+{
+	{ "empty", { NULL }, "IOTZSLJ", 4, { 17, 153, 5264, 94477 }, 94470 },
+	{ "midgame", { "#.........", "##...#..##", "###.####.#", "####.#####" }, "TZSLJIO", 4, { 34, 595, 10752, 392830 }, 392670 },
+};
 
-	// select the vertex and index buffer to display
-	d3ddev->SetIndices(i_buffer);
-	
-	if(danger)
-		D3DXMatrixRotationZ(&matRotateZ,rot);
-	else
-		D3DXMatrixRotationZ(&matRotateZ,0.0f);
+// counts each setup on one thread, on every core and deduplicated, and
+// checks them against the known counts
+void benchmark_perft(void)
+{
+	wchar_t msg[200];
 
-	//draw current block that is moving
-	for(i = 0; i < 4; i++)
+	for(int s = 0; s < (int)(sizeof(perftSetups) / sizeof(perftSetups[0])); s++)
 	{
-		for(j = 0; j < 4; j++)
+		const PerftSetup *setup = &perftSetups[s];
+		PerftResult single, parallel, dedup;
+		int sequence[PERFT_MAXDEPTH + 1], count;
+		GameState state;
+		int rows = 0;
+		bool valid = true;
+
+		reset_game(&state, 1);
+		while(rows < 4 && setup->rows[rows])
+			rows++;
+		for(int r = 0; r < rows; r++)
+			for(int x = 0; x < MAPWIDTH; x++)
+				state.map[x][MAPHEIGHT - rows + r] = setup->rows[r][x] == '#' ? TILEGREY : TILEBLACK;
+		count = perft_sequence(setup->pieces, sequence, PERFT_MAXDEPTH + 1);
+
+		perft(&state, sequence, count, setup->depth, false, 1, &single);
+		perft(&state, sequence, count, setup->depth, false, 0, &parallel);
+		perft(&state, sequence, count, setup->depth, true, 0, &dedup);
+		for(int d = 1; d <= setup->depth; d++)
+			valid = valid && single.counts[d] == setup->paths[d - 1] && parallel.counts[d] == setup->paths[d - 1];
+		valid = valid && dedup.counts[setup->depth] == setup->boards;
+
+		swprintf_s(msg, L"perft: %-8S depth %d %lld paths %lld boards, 1 thread %.0f placements/s, %d threads %.0f placements/s, dedup %.0f placements/s%s\n",
+			setup->name, setup->depth, parallel.counts[setup->depth], dedup.counts[setup->depth],
+			single.placements / (single.seconds > 0 ? single.seconds : 1), cpu_count(),
+			parallel.placements / (parallel.seconds > 0 ? parallel.seconds : 1),
+			dedup.placements / (dedup.seconds > 0 ? dedup.seconds : 1), valid ? L"" : L" MISMATCH");
+		OutputDebugString(msg);
+	}
+}
+
+// frame time against board count: wall_build alone into memory (the null
+// backend) on one thread and on every core, then whole frames on the device
+void benchmark_wall(void)
+{
+	static const int counts[] = { 1, 4, 16, 64, 128, 256 };
+	const int frames = 20;
+	GameState *games = new GameState[256];
+	const GameState **boards = new const GameState*[256];
+	WallView *views = new WallView[256];
+	WallVertex *vertices = new WallVertex[256 * WALL_BOARDCUBES * WALL_CUBEVERTICES];
+	Wall *single = wall_create(1), *parallel = wall_create(0);
+	LPDIRECT3DQUERY9 finished = NULL;
+	unsigned int random = 1;
+	wchar_t msg[200];
+
+	//the device only queues the draws, each frame waits until the GPU has run them
+	if(FAILED(d3ddev->CreateQuery(D3DQUERYTYPE_EVENT, &finished)))
+		finished = NULL;
+
+	//boards part way through a game, restarted if the bot tops out
+	for(int i = 0; i < 256; i++)
+	{
+		init_game(&games[i], i + 1);
+		for(int t = 0; t < 200 * (i % 16 + 1); t++)
 		{
-			if(piece.size[i][j] != TILENODRAW)
-			{
-				D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * (piece.x + i)),0.0f,(FLOAT)(TILESIZE * -(piece.y + j)));
-				d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-				d3ddev->SetStreamSource(0, v_buffer[piece.size[i][j] - 2], 0, sizeof(CUSTOMVERTEX));
-				d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
-			}
+			random = random * 214013 + 2531011;
+			step_game(&games[i], (random >> 16) % 5 == 0 ? 1 << ((random >> 20) % 4) : 0);
+			if(!games[i].gameStarted)
+				init_game(&games[i], random);
 		}
+		boards[i] = &games[i];
 	}
 
-	//draw preview block
-	for(i = 0; i < 4; i++)
+	for(int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); c++)
 	{
-		for(j = 0; j < 4; j++)
+		WallCamera camera;
+		double start, singleTime, parallelTime, frameTime;
+		int n = counts[c], cubes = 0, draws = 0;
+
+		wall_layout(n, (FLOAT)SCREEN_WIDTH / (FLOAT)SCREEN_HEIGHT, D3DXToRadian(45), views, &camera);
+
+		start = time_usec();
+		for(int f = 0; f < frames; f++)
+		{
+			cubes = wall_count(single, boards, n);
+			wall_build(single, boards, views, n, 0.5f, vertices);
+		}
+		singleTime = (time_usec() - start) / frames;
+
+		start = time_usec();
+		for(int f = 0; f < frames; f++)
+		{
+			wall_count(parallel, boards, n);
+			wall_build(parallel, boards, views, n, 0.5f, vertices);
+		}
+		parallelTime = (time_usec() - start) / frames;
+
+		start = time_usec();
+		for(int f = 0; f < frames; f++)
 		{
-			if(prePiece.size[i][j] != TILENODRAW)
+			d3ddev->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_XRGB(0, 0, 0), 1.0f, 0);
+			d3ddev->BeginScene();
+			d3ddev->SetFVF(CUSTOMFVF);
+			draws = draw_wall(boards, n);
+			d3ddev->EndScene();
+			if(finished)
 			{
-				D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * (prePiece.x + i)),0.0f,(FLOAT)(TILESIZE * -(prePiece.y + j)));
-				d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-				d3ddev->SetStreamSource(0, v_buffer[prePiece.size[i][j] - 2], 0, sizeof(CUSTOMVERTEX));
-				d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
+				finished->Issue(D3DISSUE_END);
+				while(finished->GetData(NULL, 0, D3DGETDATA_FLUSH) == S_FALSE)
+					;
 			}
+			else
+				d3ddev->Present(NULL, NULL, NULL, NULL); // no event queries, presenting keeps the queue from running ahead
 		}
+		frameTime = (time_usec() - start) / frames;
+
+		swprintf_s(msg, L"wall: %3d boards %6d cubes %2d draws, build %.3f ms 1 thread %.3f ms %d threads, frame %.3f ms\n",
+			n, cubes, draws, singleTime / 1e3, parallelTime / 1e3, cpu_count(), frameTime / 1e3);
+		OutputDebugString(msg);
 	}
 
-	//draw map
-	for(i = 0; i < MAPWIDTH; i++)
+	if(finished)
+		finished->Release();
+	wall_destroy(single);
+	wall_destroy(parallel);
+	delete [] vertices;
+	delete [] views;
+	delete [] boards;
+	delete [] games;
+}
+
+// steps 4096 environments with random actions on one thread and then on every core
+void benchmark_env(void)
+{
+	const int count = 4096, steps = 200;
+	unsigned char *actions = new unsigned char[count];
+	unsigned char *boards = new unsigned char[count * ENV_BOARD_SIZE];
+	float *features = new float[count * ENV_FEATURES];
+	float *rewards = new float[count];
+	unsigned char *dones = new unsigned char[count];
+	LARGE_INTEGER freq, start, end;
+	unsigned int random = 1;
+	double rate[2];
+	int pass, n, i;
+	wchar_t msg[128];
+
+	QueryPerformanceFrequency(&freq);
+	for(pass = 0; pass < 2; pass++)
 	{
-		for(j = 0; j < MAPHEIGHT + 1; j++)
+		TetrisEnv *env = tetris_env_create(count, 1, 4, pass == 0 ? 1 : 0);
+
+		tetris_env_reset(env, boards, NULL, features);
+		QueryPerformanceCounter(&start);
+		for(n = 0; n < steps; n++)
 		{
-			if(map[i][j] != TILEBLACK)
+			for(i = 0; i < count; i++)
 			{
-				D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * i),0.0f,(FLOAT)-(TILESIZE * j));
-				d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-				d3ddev->SetStreamSource(0, v_buffer[map[i][j] - 2], 0, sizeof(CUSTOMVERTEX));
-				d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
+				random = random * 214013 + 2531011;
+				actions[i] = (random >> 16) & 15;
 			}
+			tetris_env_step(env, actions, boards, NULL, features, rewards, dones);
 		}
+		QueryPerformanceCounter(&end);
+		rate[pass] = (double)count * steps * freq.QuadPart / (end.QuadPart - start.QuadPart);
+		tetris_env_destroy(env);
 	}
 
-	//left border
-	i = -1;
-	d3ddev->SetStreamSource(0, v_buffer[TILEGREY - 2], 0, sizeof(CUSTOMVERTEX));
-	for(j = 0; j < MAPHEIGHT + 1; j++)
+	swprintf_s(msg, L"env: %.0f steps/s on 1 thread, %.0f steps/s on %d threads\n", rate[0], rate[1], cpu_count());
+	OutputDebugString(msg);
+
+	delete[] actions;
+	delete[] boards;
+	delete[] features;
+	delete[] rewards;
+	delete[] dones;
+}
+#endif
+
+void capture_frame(void)
+{
+	LPDIRECT3DSURFACE9 backBuffer;
+	D3DLOCKED_RECT locked;
+	unsigned char *frame;
+
+	if(!capture_running())
+		return;
+
+	//never wait on the encoders, the frame is dropped if they are behind
+	frame = capture_acquire();
+	if(!frame)
+		return;
+
+	//a copy that fails once fails every frame, stop instead of recording nothing
+	if(!captureSurface && FAILED(d3ddev->CreateOffscreenPlainSurface(SCREEN_WIDTH, SCREEN_HEIGHT, D3DFMT_X8R8G8B8, D3DPOOL_SYSTEMMEM, &captureSurface, NULL)))
 	{
-		D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * i),0.0f,(FLOAT)-(TILESIZE * j));
-		d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-		d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
+		captureSurface = NULL;
+		end_capture(L"failed, no copy surface");
+		return;
 	}
-	//top border
-	j = -1;
-	for(i = -1; i < MAPWIDTH + 1; i++)
+
+	if(FAILED(d3ddev->GetRenderTarget(0, &backBuffer)))
 	{
-		D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * i),0.0f,(FLOAT)-(TILESIZE * j));
-		d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-		d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
+		end_capture(L"failed, no back buffer");
+		return;
 	}
-	//right border
-	i = MAPWIDTH;
-	for(j = 0; j < MAPHEIGHT+ 1; j++)
+	if(FAILED(d3ddev->GetRenderTargetData(backBuffer, captureSurface)))
 	{
-		D3DXMatrixTranslation(&matTranslate,(FLOAT)(TILESIZE * i),0.0f,(FLOAT)-(TILESIZE * j));
-		d3ddev->SetTransform(D3DTS_WORLD, &(matRotateZ * matTranslate));
-		d3ddev->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 24, 0, 12);
+		backBuffer->Release();
+		end_capture(L"failed to copy the back buffer");
+		return;
+	}
+	backBuffer->Release();
+
+	if(FAILED(captureSurface->LockRect(&locked, NULL, D3DLOCK_READONLY)))
+	{
+		end_capture(L"failed to lock the copy");
+		return;
+	}
+	for(int y = 0; y < SCREEN_HEIGHT; y++)
+		memcpy(frame + y * SCREEN_WIDTH * 4, (BYTE*)locked.pBits + y * locked.Pitch, SCREEN_WIDTH * 4);
+	captureSurface->UnlockRect();
+
+	capture_submit(frame);
+}
+
+void end_capture(const wchar_t *how)
+{
+	CaptureStats stats;
+
+	capture_stop(); // the buffer capture_frame acquired goes with the others
+	capture_stats(&stats);
+	swprintf_s(captureReport, L"capture %s: %ld frames encoded, %ld dropped, %ld failed, %.1f frames/sec",
+		how, stats.encoded, stats.dropped, stats.failed, stats.seconds > 0.0 ? stats.encoded / stats.seconds : 0.0);
+	captureReportTime = GetTickCount();
+	OutputDebugString(captureReport);
+	OutputDebugString(L"\n");
+}
+
+void capture_status(void)
+{
+	CaptureStats stats;
+	wchar_t text[160];
+
+	if(capture_running())
+	{
+		capture_stats(&stats);
+		swprintf_s(text, L"REC %ld frames, %ld dropped, %ld failed, %.0f sec", stats.captured, stats.dropped, stats.failed, stats.seconds);
 	}
+	else if(captureReport[0] && GetTickCount() - captureReportTime < 5000)
+		wcscpy_s(text, captureReport);
+	else
+		return;
+
+	//a scene of its own after capture_frame, so the status never ends up in the recording
+	d3ddev->BeginScene();
+	display_text(text, 0, SCREEN_WIDTH - 10, 10, 30, RIGHT);
+	d3ddev->EndScene();
+}
+
+void toggle_capture(int format)
+{
+	if(capture_running())
+		end_capture(L"stopped");
+	else if(!capture_start(format == CAPTURE_Y4M ? "capture.y4m" : "capture", format, SCREEN_WIDTH, SCREEN_HEIGHT, 60, 4))
+	{
+		wcscpy_s(captureReport, L"capture failed to start, out of memory or the file would not open");
+		captureReportTime = GetTickCount();
+		OutputDebugString(L"capture failed to start\n");
+	}
+}
+
+void init_metrics(LPSTR cmdLine)
+{
+	char path[260];
+	int port;
+	const char *arg;
+
+	frameTimeMetric = metric_register("tetris_frame_time_microseconds", "Time between rendered frames.", METRIC_HISTOGRAM);
+	tickTimeMetric = metric_register("tetris_tick_time_microseconds", "Time to apply one gravity step.", METRIC_HISTOGRAM);
+	inputLatencyMetric = metric_register("tetris_input_latency_microseconds", "Time from a key press to the next presented frame.", METRIC_HISTOGRAM);
+	piecesMetric = metric_register("tetris_pieces_total", "Pieces spawned, rate() gives pieces per second.", METRIC_COUNTER);
+	linesMetric = metric_register("tetris_lines_total", "Lines cleared.", METRIC_COUNTER);
+
+	arg = strstr(cmdLine, "-metrics-port ");
+	if(arg && sscanf(arg + 14, "%d", &port) == 1)
+		metrics_serve(port);
+
+	arg = strstr(cmdLine, "-metrics-file ");
+	if(arg && sscanf(arg + 14, "%259s", path) == 1)
+		metrics_snapshot(path, 10);
 }
 
 void display_text(wchar_t *disText, LONG rctLeft, LONG rctRight, LONG rctTop, LONG rctBottom, int justify)
@@ -738,6 +1410,15 @@ void cleanD3D(void)
 	d3ddev->Release();    // close and release the 3D device
     d3d->Release();    // close and release Direct3D
 	m_font->Release(); // close and release font
+	if(captureSurface)
+		captureSurface->Release(); // release the capture copy if we recorded
+	if(wallVertices)
+		wallVertices->Release();
+	if(wallIndices)
+		wallIndices->Release();
+	wall_destroy(wall);
+	delete [] wallBoards;
+	delete [] wallGames;
 }
 
 // the entry point for any Windows program
@@ -751,6 +1432,72 @@ int WINAPI WinMain(HINSTANCE hInstance,
     // this struct holds information for the window class
     WNDCLASSEX wc;
 
+	init_metrics(lpCmdLine);
+
+	//converts an analytics log and exits: -analytics-csv in.tpa out.csv
+	if(strstr(lpCmdLine, "-analytics-csv "))
+	{
+		char in[260], out[260];
+
+		if(sscanf(strstr(lpCmdLine, "-analytics-csv ") + 15, "%259s %259s", in, out) != 2)
+			return 1;
+		return analytics_export_csv(in, out) < 0;
+	}
+
+	//move generator perft in a console and exits: -perft depth [pieces] [dedup]
+	if(strstr(lpCmdLine, "-perft "))
+	{
+		int result;
+
+		if(!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		freopen("CONOUT$", "w", stdout);
+		result = perft_main(strstr(lpCmdLine, "-perft ") + 7);
+		metrics_shutdown();
+		return result;
+	}
+
+	//-analytics prefix logs every piece of every game to prefix000.tpa, a new file every 64 MB
+	{
+		const char *arg = strstr(lpCmdLine, "-analytics ");
+		char prefix[260];
+
+		if(arg && sscanf(arg + 11, "%259s", prefix) == 1)
+			analytics_start(prefix, 64 << 20);
+	}
+
+	//encodes a replay headless and exits: -capture-replay seed inputs out.y4m (or a PNG prefix),
+	//inputs holding one INPUT_* byte per tick of a game started with init_game(seed)
+	if(strstr(lpCmdLine, "-capture-replay "))
+	{
+		int result;
+
+		if(!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		freopen("CONOUT$", "w", stdout);
+		result = capture_main(strstr(lpCmdLine, "-capture-replay ") + 16);
+		metrics_shutdown();
+		return result;
+	}
+
+	//headless play in a console, no window or Direct3D
+	if(strstr(lpCmdLine, "-terminal"))
+	{
+		const RuleVariant *rules = find_rules("classic");
+		const char *arg = strstr(lpCmdLine, "-rules ");
+		char name[32];
+		int result;
+
+		if(arg && sscanf(arg + 7, "%31s", name) == 1 && find_rules(name))
+			rules = find_rules(name);
+		if(!AttachConsole(ATTACH_PARENT_PROCESS))
+			AllocConsole();
+		result = terminal_play(GetTickCount(), rules);
+		analytics_stop();
+		metrics_shutdown();
+		return result;
+	}
+
     // clear out the window class for use
     ZeroMemory(&wc, sizeof(WNDCLASSEX));
 
@@ -806,7 +1553,50 @@ int WINAPI WinMain(HINSTANCE hInstance,
 
 	initD3D(hWnd);
 
-	init_game();
+	startTime = GetTickCount();
+	init_game(&game, GetTickCount());
+	pieceStart = time_usec();
+
+	if(analytics_running())
+		set_lock_hook(game_locked);
+
+	//-wall N plays N games with a random bot and shows them all in a grid
+	{
+		const char *arg = strstr(lpCmdLine, "-wall ");
+		int count;
+
+		if(arg && sscanf(arg + 6, "%d", &count) == 1 && count > 0)
+		{
+			if(count > WALL_MAXBOARDS)
+				count = WALL_MAXBOARDS;
+			wallGames = new GameState[count];
+			wallBoards = new const GameState*[count];
+			for(int i = 0; i < count; i++)
+			{
+				init_game(&wallGames[i], GetTickCount() + i);
+				wallBoards[i] = &wallGames[i];
+			}
+			wallCount = count;
+		}
+	}
+
+	//-shared-state exports the live game to other processes, see SharedState.h
+	if(strstr(lpCmdLine, "-shared-state"))
+		shared_open(NULL);
+
+#ifdef TETRIS_BENCHMARK
+	run_benchmark(benchmark_transforms);
+	run_benchmark(benchmark_rollback);
+	run_benchmark(benchmark_rollback_network);
+	run_benchmark(benchmark_spectator);
+	run_benchmark(benchmark_rules);
+	run_benchmark(benchmark_env);
+	run_benchmark(benchmark_analytics);
+	run_benchmark(benchmark_shared);
+	run_benchmark(benchmark_solver);
+	run_benchmark(benchmark_perft);
+	run_benchmark(benchmark_wall);
+#endif
 
     // enter the main loop:
 
@@ -828,10 +1618,29 @@ int WINAPI WinMain(HINSTANCE hInstance,
 		if(msg.message == WM_QUIT)
 			break;
 
-		game_timer();
+		if(wallCount)
+			wall_timer();
+		else
+			game_timer();
+		shared_publish(&game);
 		render_frame();
 	}
 
+	if(capture_running())
+		toggle_capture(CAPTURE_Y4M); // flush and report the recording
+	shared_close();
+	if(analytics_running())
+	{
+		AnalyticsStats stats;
+		wchar_t msg[128];
+
+		analytics_stop();
+		analytics_stats(&stats);
+		swprintf_s(msg, L"analytics: %ld pieces logged to %d files, %ld dropped, %ld lost\n", stats.written, stats.files, stats.dropped, stats.lost);
+		OutputDebugString(msg);
+	}
+	metrics_shutdown();
+
 	cleanD3D();
 
     // return this part of the WM_QUIT message to Windows
@@ -871,6 +1680,15 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPara
 				{
 					
 					USHORT keyCode = raw->data.keyboard.VKey;
+
+					//input latency runs from the first unhandled game key press to the next Present
+					if(!(raw->data.keyboard.Flags & RI_KEY_BREAK) &&
+						(keyCode == VK_DOWN || keyCode == VK_LEFT || keyCode == VK_RIGHT || keyCode == VK_SPACE))
+					{
+						if(inputStart == 0.0)
+							inputStart = time_usec();
+						pieceInputs++;
+					}
 					switch(keyCode)
 					{
 						case VK_DOWN:
@@ -878,28 +1696,36 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lPara
 							if(keyArrowDUp)
 								lastDInputTime = GetTickCount();
 							if((GetTickCount() - lastDInputTime > 100))
-								move_block(0,1);
+								fall_block();
 							break;
 						case VK_LEFT:
 							keyArrowLUp = raw->data.keyboard.Flags & RI_KEY_BREAK;
 							if(keyArrowLUp)
 								lastLInputTime = GetTickCount();
 							if(GetTickCount() - lastLInputTime > 100)
-								move_block(-1,0);
+								move_block(&game,-1,0);
 							break;
 						case VK_RIGHT:
 							keyArrowRUp = raw->data.keyboard.Flags & RI_KEY_BREAK;
 							if(keyArrowRUp)
 								lastRInputTime = GetTickCount();
 							if(GetTickCount() - lastRInputTime > 100)
-								move_block(1,0);
+								move_block(&game,1,0);
 							break;
 						case VK_SPACE:
 							keySpaceUp = raw->data.keyboard.Flags & RI_KEY_BREAK;
 							if(keySpaceUp)
 								lastRotInputTime = GetTickCount();
 							if(GetTickCount() - lastRotInputTime > 100)
-								rotate_block();
+								rotate_block(&game);
+							break;
+						case VK_F9: // record video
+							if(raw->data.keyboard.Flags & RI_KEY_BREAK)
+								toggle_capture(CAPTURE_Y4M);
+							break;
+						case VK_F10: // record png sequence
+							if(raw->data.keyboard.Flags & RI_KEY_BREAK)
+								toggle_capture(CAPTURE_PNG);
 							break;
 						default:
 							break;
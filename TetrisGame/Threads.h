@@ -0,0 +1,100 @@
+#pragma once
+
+// small threading helpers for the background workers. Kept free of any
+// game or Direct3D code so the modules using it also build on Linux
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#define THREADPROC DWORD WINAPI // return type of a thread entry point, return 0
+typedef DWORD (WINAPI *ThreadProc)(void *arg);
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
+
+inline bool thread_create(Thread *t, ThreadProc proc, void *arg) { *t = CreateThread(NULL, 0, proc, arg, 0, NULL); return *t != NULL; }
+inline void thread_join(Thread t) { WaitForSingleObject(t, INFINITE); CloseHandle(t); }
+inline void mutex_init(Mutex *m) { InitializeCriticalSection(m); }
+inline void mutex_destroy(Mutex *m) { DeleteCriticalSection(m); }
+inline void mutex_lock(Mutex *m) { EnterCriticalSection(m); }
+inline void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+inline void cond_init(CondVar *c) { InitializeConditionVariable(c); }
+inline void cond_destroy(CondVar *c) { }
+inline void cond_wait(CondVar *c, Mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+inline void cond_signal(CondVar *c) { WakeConditionVariable(c); }
+inline void cond_broadcast(CondVar *c) { WakeAllConditionVariable(c); }
+inline long atomic_add(volatile long *v, long n) { return InterlockedExchangeAdd(v, n) + n; } // returns the new value
+inline long long atomic_add64(volatile long long *v, long long n) { return InterlockedExchangeAdd64(v, n) + n; }
+inline bool atomic_cas(volatile long *v, long expected, long n) { return InterlockedCompareExchange(v, n, expected) == expected; } // true if v was expected and is now n
+inline bool atomic_cas64(volatile long long *v, long long expected, long long n) { return InterlockedCompareExchange64(v, n, expected) == expected; } // true if v was expected and is now n
+inline long long atomic_load64(volatile long long *v) { return InterlockedCompareExchange64(v, 0, 0); }
+inline void atomic_store64(volatile long long *v, long long n) { InterlockedExchange64(v, n); }
+inline void atomic_release(volatile long *v, long n) { *v = n; } // plain store, MSVC volatile writes are release
+inline long atomic_acquire(volatile long *v) { return *v; } // and volatile reads acquire
+inline int atomic_add(volatile int *v, int n) { return (int)InterlockedExchangeAdd((volatile long*)v, n) + n; } // int versions for layouts shared with other compilers, where long differs
+inline void atomic_release(volatile int *v, int n) { *v = n; }
+inline int atomic_acquire(volatile int *v) { return *v; }
+inline void memory_fence(void) { MemoryBarrier(); } // no load or store moves across it
+inline void sleep_msec(int ms) { Sleep(ms); }
+inline int cpu_count(void) { SYSTEM_INFO si; GetSystemInfo(&si); return (int)si.dwNumberOfProcessors; }
+
+// microseconds from an arbitrary start point
+inline double time_usec(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if(freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart * 1e6 / (double)freq.QuadPart;
+}
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADPROC void *
+typedef void *(*ThreadProc)(void *arg);
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+
+inline bool thread_create(Thread *t, ThreadProc proc, void *arg) { return pthread_create(t, NULL, proc, arg) == 0; }
+inline void thread_join(Thread t) { pthread_join(t, NULL); }
+inline void mutex_init(Mutex *m) { pthread_mutex_init(m, NULL); }
+inline void mutex_destroy(Mutex *m) { pthread_mutex_destroy(m); }
+inline void mutex_lock(Mutex *m) { pthread_mutex_lock(m); }
+inline void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+inline void cond_init(CondVar *c) { pthread_cond_init(c, NULL); }
+inline void cond_destroy(CondVar *c) { pthread_cond_destroy(c); }
+inline void cond_wait(CondVar *c, Mutex *m) { pthread_cond_wait(c, m); }
+inline void cond_signal(CondVar *c) { pthread_cond_signal(c); }
+inline void cond_broadcast(CondVar *c) { pthread_cond_broadcast(c); }
+inline long atomic_add(volatile long *v, long n) { return __sync_add_and_fetch(v, n); } // returns the new value
+inline long long atomic_add64(volatile long long *v, long long n) { return __sync_add_and_fetch(v, n); }
+inline bool atomic_cas(volatile long *v, long expected, long n) { return __sync_bool_compare_and_swap(v, expected, n); } // true if v was expected and is now n
+inline bool atomic_cas64(volatile long long *v, long long expected, long long n) { return __sync_bool_compare_and_swap(v, expected, n); } // true if v was expected and is now n
+inline long long atomic_load64(volatile long long *v) { return __sync_add_and_fetch(v, 0); }
+inline void atomic_store64(volatile long long *v, long long n) { long long old = *v; while(!__sync_bool_compare_and_swap(v, old, n)) old = *v; }
+inline void atomic_release(volatile long *v, long n) { __atomic_store_n(v, n, __ATOMIC_RELEASE); } // earlier writes are visible first
+inline long atomic_acquire(volatile long *v) { return __atomic_load_n(v, __ATOMIC_ACQUIRE); } // later reads see what the releaser wrote
+inline int atomic_add(volatile int *v, int n) { return __sync_add_and_fetch(v, n); } // int versions for layouts shared with other compilers, where long differs
+inline void atomic_release(volatile int *v, int n) { __atomic_store_n(v, n, __ATOMIC_RELEASE); }
+inline int atomic_acquire(volatile int *v) { return __atomic_load_n(v, __ATOMIC_ACQUIRE); }
+inline void memory_fence(void) { __sync_synchronize(); } // no load or store moves across it
+inline void sleep_msec(int ms) { usleep(ms * 1000); }
+inline int cpu_count(void) { long n = sysconf(_SC_NPROCESSORS_ONLN); return n > 0 ? (int)n : 1; }
+
+// microseconds from an arbitrary start point
+inline double time_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+#endif
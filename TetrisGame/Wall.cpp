@@ -0,0 +1,351 @@
+#include "Wall.h"
+#include "Profiler.h"
+#include "Threads.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WALL_MAXTHREADS 64
+#define CELLWIDTH (MAPWIDTH + 8) // tiles across a board's cell: borders, preview and a gap
+#define CELLHEIGHT (MAPHEIGHT + 3) // tiles down it: borders, floor and a gap
+
+struct Wall
+{
+	// the current call's arguments, read by the workers
+	const GameState *const *games;
+	const WallView *views;
+	int count;
+	WallVertex *out;
+	WallVertex still[WALL_CUBEVERTICES], spun[WALL_CUBEVERTICES]; // a cube at the origin, without and with the danger spin
+
+	int *offsets; // first cube of each board, offsets[count] is the total
+	int capacity; // boards offsets has room for
+
+	// worker pool: each worker builds a fixed share of the cubes
+	Thread threads[WALL_MAXTHREADS];
+	int threadCount;
+	Mutex lock;
+	CondVar start, finished;
+	int generation; // bumped for every build so workers know there is work
+	int pending; // slices not yet taken by a worker
+	int running; // slices not yet finished
+	bool quit;
+};
+
+// the vertices of create_vertices: position, then normal
+static const float cube[WALL_CUBEVERTICES][6] =
+{
+	{ -1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f }, // side 1
+	{ 1.0f, -1.0f, 1.0f, 0.0f, 0.0f, 1.0f },
+	{ -1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f },
+	{ 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 1.0f },
+
+	{ -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f }, // side 2
+	{ -1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f },
+	{ 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f },
+	{ 1.0f, 1.0f, -1.0f, 0.0f, 0.0f, -1.0f },
+
+	{ -1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f }, // side 3
+	{ -1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f },
+	{ 1.0f, 1.0f, -1.0f, 0.0f, 1.0f, 0.0f },
+	{ 1.0f, 1.0f, 1.0f, 0.0f, 1.0f, 0.0f },
+
+	{ -1.0f, -1.0f, -1.0f, 0.0f, -1.0f, 0.0f }, // side 4
+	{ 1.0f, -1.0f, -1.0f, 0.0f, -1.0f, 0.0f },
+	{ -1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f },
+	{ 1.0f, -1.0f, 1.0f, 0.0f, -1.0f, 0.0f },
+
+	{ 1.0f, -1.0f, -1.0f, 1.0f, 0.0f, 0.0f }, // side 5
+	{ 1.0f, 1.0f, -1.0f, 1.0f, 0.0f, 0.0f },
+	{ 1.0f, -1.0f, 1.0f, 1.0f, 0.0f, 0.0f },
+	{ 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f },
+
+	{ -1.0f, -1.0f, -1.0f, -1.0f, 0.0f, 0.0f }, // side 6
+	{ -1.0f, -1.0f, 1.0f, -1.0f, 0.0f, 0.0f },
+	{ -1.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f },
+	{ -1.0f, 1.0f, 1.0f, -1.0f, 0.0f, 0.0f },
+};
+
+// the triangles of i_buffer
+static const unsigned short cubeIndices[WALL_CUBEINDICES] =
+{
+	0, 1, 2, 2, 1, 3, // side 1
+	4, 5, 6, 6, 5, 7, // side 2
+	8, 9, 10, 10, 9, 11, // side 3
+	12, 13, 14, 14, 13, 15, // side 4
+	16, 17, 18, 18, 17, 19, // side 5
+	20, 21, 22, 22, 21, 23, // side 6
+};
+
+static unsigned int colors[TILEAQUA + 1]; // tileColors as D3DCOLOR_XRGB
+
+// the cube turned about z like D3DXMatrixRotationZ, as draw_blocks turns cubes in danger
+static void turn_cube(WallVertex *shape, float angle)
+{
+	float c = cosf(angle), s = sinf(angle);
+
+	for(int k = 0; k < WALL_CUBEVERTICES; k++)
+	{
+		const float *v = cube[k];
+
+		shape[k].x = v[0] * c - v[1] * s;
+		shape[k].y = v[0] * s + v[1] * c;
+		shape[k].z = v[2];
+		shape[k].nx = v[3] * c - v[4] * s;
+		shape[k].ny = v[3] * s + v[4] * c;
+		shape[k].nz = v[5];
+		shape[k].color = 0;
+	}
+}
+
+inline WallVertex *emit(WallVertex *v, const WallVertex *shape, const WallView *view, int tileX, int tileY, int tile)
+{
+	float x = view->x + (float)(TILESIZE * tileX), z = view->z - (float)(TILESIZE * tileY);
+	unsigned int color = colors[tile];
+
+	for(int k = 0; k < WALL_CUBEVERTICES; k++, v++)
+	{
+		*v = shape[k];
+		v->x += x;
+		v->z += z;
+		v->color = color;
+	}
+	return v;
+}
+
+// the cubes of build_instances, in the same order
+static void build_board(Wall *w, int b)
+{
+	PROFILE_SCOPE(PROFILE_INSTANCES);
+	const GameState *g = w->games[b];
+	const WallView *view = &w->views[b];
+	const WallVertex *shape = g->danger ? w->spun : w->still;
+	WallVertex *v = w->out + (size_t)w->offsets[b] * WALL_CUBEVERTICES;
+	int i, j;
+
+	//current block that is moving
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(g->piece.size[i][j] != TILENODRAW)
+				v = emit(v, shape, view, g->piece.x + i, g->piece.y + j, g->piece.size[i][j]);
+
+	//preview block
+	for(i = 0; i < 4; i++)
+		for(j = 0; j < 4; j++)
+			if(g->prePiece.size[i][j] != TILENODRAW)
+				v = emit(v, shape, view, g->prePiece.x + i, g->prePiece.y + j, g->prePiece.size[i][j]);
+
+	//map
+	for(i = 0; i < MAPWIDTH; i++)
+		for(j = 0; j < MAPHEIGHT + 1; j++)
+			if(g->map[i][j] != TILEBLACK)
+				v = emit(v, shape, view, i, j, g->map[i][j]);
+
+	//left border
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		v = emit(v, shape, view, -1, j, TILEGREY);
+	//top border
+	for(i = -1; i < MAPWIDTH + 1; i++)
+		v = emit(v, shape, view, i, -1, TILEGREY);
+	//right border
+	for(j = 0; j < MAPHEIGHT + 1; j++)
+		v = emit(v, shape, view, MAPWIDTH, j, TILEGREY);
+}
+
+// slices split the cubes evenly rather than the boards, full boards cost more
+static void build_slice(Wall *w, int slice)
+{
+	long long total = w->offsets[w->count], slices = w->threadCount + 1;
+
+	for(int b = 0; b < w->count; b++)
+		if(w->offsets[b] * slices / total == slice)
+			build_board(w, b);
+}
+
+static THREADPROC wall_worker(void *arg)
+{
+	Wall *w = (Wall*)arg;
+	int seen = 0;
+
+	for(;;)
+	{
+		int slice;
+
+		mutex_lock(&w->lock);
+		while(w->generation == seen && !w->quit)
+			cond_wait(&w->start, &w->lock);
+		if(w->quit)
+		{
+			mutex_unlock(&w->lock);
+			break;
+		}
+		seen = w->generation;
+		slice = --w->pending; // slices are handed out in arrival order
+		mutex_unlock(&w->lock);
+
+		build_slice(w, slice);
+
+		mutex_lock(&w->lock);
+		if(--w->running == 0)
+			cond_signal(&w->finished);
+		mutex_unlock(&w->lock);
+	}
+	return 0;
+}
+
+Wall *wall_create(int threads)
+{
+	Wall *w = (Wall*)calloc(1, sizeof(Wall));
+
+	if(!w)
+		return NULL;
+	for(int tile = 0; tile <= TILEAQUA; tile++)
+		colors[tile] = 0xff000000u | tileColors[tile][0] << 16 | tileColors[tile][1] << 8 | tileColors[tile][2];
+	turn_cube(w->still, 0.0f);
+
+	if(threads <= 0)
+		threads = cpu_count();
+	if(threads > WALL_MAXTHREADS)
+		threads = WALL_MAXTHREADS;
+
+	mutex_init(&w->lock);
+	cond_init(&w->start);
+	cond_init(&w->finished);
+	for(int i = 0; i < threads - 1; i++)
+	{
+		if(!thread_create(&w->threads[i], wall_worker, w))
+			break;
+		w->threadCount++;
+	}
+	return w;
+}
+
+void wall_destroy(Wall *w)
+{
+	if(!w)
+		return;
+
+	mutex_lock(&w->lock);
+	w->quit = true;
+	cond_broadcast(&w->start);
+	mutex_unlock(&w->lock);
+	for(int i = 0; i < w->threadCount; i++)
+		thread_join(w->threads[i]);
+
+	cond_destroy(&w->finished);
+	cond_destroy(&w->start);
+	mutex_destroy(&w->lock);
+	free(w->offsets);
+	free(w);
+}
+
+int wall_layout(int count, float aspect, float fieldOfView, WallView *views, WallCamera *camera)
+{
+	float slope = tanf(fieldOfView / 2.0f);
+	float bestWidth = 0.0f, bestHeight = 0.0f, bestHeightSeen = 0.0f;
+	int columns = 1;
+
+	if(count > WALL_MAXBOARDS)
+		count = WALL_MAXBOARDS;
+
+	//the column count that lets the camera come closest
+	for(int c = 1; c <= (count > 0 ? count : 1); c++)
+	{
+		int rows = (count + c - 1) / c;
+		float width = (float)(TILESIZE * (c * CELLWIDTH - 1)), height = (float)(TILESIZE * (rows * CELLHEIGHT - 1));
+		float seen = height > width / aspect ? height : width / aspect;
+
+		if(c == 1 || seen < bestHeightSeen)
+		{
+			columns = c;
+			bestWidth = width;
+			bestHeight = height;
+			bestHeightSeen = seen;
+		}
+	}
+
+	//tile -1,-1 of the top left board sits on the world origin
+	for(int b = 0; b < count; b++)
+	{
+		views[b].x = (float)(TILESIZE * ((b % columns) * CELLWIDTH + 1));
+		views[b].z = -(float)(TILESIZE * ((b / columns) * CELLHEIGHT + 1));
+	}
+
+	camera->x = (bestWidth - TILESIZE) / 2.0f;
+	camera->z = -(bestHeight - TILESIZE) / 2.0f;
+	camera->height = bestHeightSeen / 2.0f / slope + TILESIZE;
+	return columns;
+}
+
+int wall_count(Wall *w, const GameState *const *games, int count)
+{
+	int total = 0;
+
+	if(count + 1 > w->capacity)
+	{
+		int *offsets = (int*)realloc(w->offsets, sizeof(int) * (count + 1));
+
+		if(!offsets)
+			return 0;
+		w->offsets = offsets;
+		w->capacity = count + 1;
+	}
+
+	for(int b = 0; b < count; b++)
+	{
+		const GameState *g = games[b];
+		int cubes = 2 * (MAPHEIGHT + 1) + MAPWIDTH + 2; // borders
+		int i, j;
+
+		for(i = 0; i < 4; i++)
+			for(j = 0; j < 4; j++)
+				cubes += (g->piece.size[i][j] != TILENODRAW) + (g->prePiece.size[i][j] != TILENODRAW);
+		for(i = 0; i < MAPWIDTH; i++)
+			for(j = 0; j < MAPHEIGHT + 1; j++)
+				cubes += g->map[i][j] != TILEBLACK;
+
+		w->offsets[b] = total;
+		total += cubes;
+	}
+	w->offsets[count] = total;
+	w->count = count;
+	return total;
+}
+
+void wall_build(Wall *w, const GameState *const *games, const WallView *views, int count, float spin, WallVertex *out)
+{
+	if(count != w->count || count == 0)
+		return; // wall_count first
+	w->games = games;
+	w->views = views;
+	w->out = out;
+	turn_cube(w->spun, spin);
+
+	if(w->threadCount == 0)
+	{
+		build_slice(w, 0);
+		return;
+	}
+
+	mutex_lock(&w->lock);
+	w->pending = w->threadCount;
+	w->running = w->threadCount;
+	w->generation++;
+	cond_broadcast(&w->start);
+	mutex_unlock(&w->lock);
+
+	// the calling thread takes the last slice instead of sitting idle
+	build_slice(w, w->threadCount);
+
+	mutex_lock(&w->lock);
+	while(w->running > 0)
+		cond_wait(&w->finished, &w->lock);
+	mutex_unlock(&w->lock);
+}
+
+void wall_indices(unsigned short *indices)
+{
+	for(int c = 0; c < WALL_BATCHCUBES; c++)
+		for(int k = 0; k < WALL_CUBEINDICES; k++)
+			indices[c * WALL_CUBEINDICES + k] = (unsigned short)(c * WALL_CUBEVERTICES + cubeIndices[k]);
+}
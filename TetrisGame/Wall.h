@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Game.h"
+
+// many boards in one frame, for tournament wallboards and bot training
+// monitors. wall_layout gives every board a cell of a grid and a camera that
+// sees them all; wall_build writes each board's cubes into one vertex array,
+// already turned by the board's danger spin and moved into its cell, so the
+// renderer submits the whole wall in a few large draws (WALL_BATCHCUBES cubes
+// each) instead of one draw per cube. Boards are built on a worker pool.
+
+#define WALL_CUBEVERTICES 24
+#define WALL_CUBEINDICES 36
+#define WALL_BATCHCUBES 2048 // cubes per draw, so 16 bit indices reach every vertex
+#define WALL_BOARDCUBES (16 + 16 + MAPWIDTH * (MAPHEIGHT + 1) + 2 * (MAPHEIGHT + 1) + MAPWIDTH + 2) // most cubes one board draws
+#define WALL_MAXBOARDS 1024
+
+struct WallVertex { float x, y, z; float nx, ny, nz; unsigned int color; }; // the CUSTOMVERTEX layout, colour as D3DCOLOR
+
+struct WallView { float x, z; }; // world position of a board's tile 0,0
+
+struct WallCamera { float x, z, height; }; // looks straight down on x,z from height, up is +z
+
+struct Wall;
+
+Wall *wall_create(int threads); //threads 0 uses every core
+void wall_destroy(Wall *w);
+int wall_layout(int count, float aspect, float fieldOfView, WallView *views, WallCamera *camera); //grid for count boards, returns the columns
+int wall_count(Wall *w, const GameState *const *games, int count); //cubes wall_build will write, call first
+void wall_build(Wall *w, const GameState *const *games, const WallView *views, int count, float spin, WallVertex *out); //every board's cubes, boards in danger turned by spin
+void wall_indices(unsigned short *indices); //WALL_BATCHCUBES * WALL_CUBEINDICES indices for the cubes of one draw